@@ -44,6 +44,18 @@ void access_counter(unsigned *hi, unsigned *lo)
         : "%edx", "%eax");
 }
 
+/* Like access_counter, but read the counter only once every earlier
+   instruction has completed (rdtscp), and start no later instruction
+   before it is read (lfence), so that two reads time exactly the code
+   between them. */
+void access_counter_serial(unsigned *hi, unsigned *lo)
+{
+    asm volatile("rdtscp; lfence; movl %%edx,%0; movl %%eax,%1"
+        : "=r" (*hi), "=r" (*lo)
+        : /* No input */
+        : "%edx", "%eax", "%ecx", "memory");
+}
+
 /* Record the current value of the cycle counter. */
 void start_counter()
 {
@@ -161,6 +173,15 @@ double get_counter()
 }
 #endif
 
+#if !defined(__i386__) && !defined(__x86_64__)
+void access_counter_serial(unsigned *hi, unsigned *lo)
+{
+    printf("ERROR: You are trying to use access_counter_serial in clock.c\n");
+    printf("that has not been implemented yet on this platform.\n");
+    exit(1);
+}
+#endif
+
 
 
 
@@ -269,12 +290,19 @@ static void callibrate(int verbose)
 
 static clock_t start_tick = 0;
 
+/* Callibrate now rather than at the first measurement, so that forked
+   processes inherit the result */
+void init_comp_counter() 
+{
+    if (cyc_per_tick == 0.0)
+        callibrate(0);
+}
+
 void start_comp_counter() 
 {
     struct tms t;
 
-    if (cyc_per_tick == 0.0)
-        callibrate(0);
+    init_comp_counter();
     times(&t);
     start_tick = t.tms_utime;
     start_counter();
@@ -6,6 +6,9 @@ void start_counter();
 /* Get # cycles since counter started */
 double get_counter();
 
+/* Read the cycle counter, ordered against the instructions around it */
+void access_counter_serial(unsigned *hi, unsigned *lo);
+
 /* Measure overhead for counter */
 double ovhd();
 
@@ -17,6 +20,8 @@ double mhz_full(int verbose, int sleeptime);
 
 /** Special counters that compensate for timer interrupt overhead */
 
+void init_comp_counter();
+
 void start_comp_counter();
 
 double get_comp_counter();
@@ -98,9 +98,13 @@
 #define ALIGNMENT 8
 
 /*
- * Maximum heap size in bytes
+ * Maximum heap size in bytes. Build with -DHEAP64 for a heap beyond 4 GB.
  */
+#if defined(HEAP64) || defined(LIBMM)
+#define MAX_HEAP (32UL<<30)  /* 32 GB, reserved but not committed */
+#else
 #define MAX_HEAP (100*(1<<20))  /* 100 MB */
+#endif
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
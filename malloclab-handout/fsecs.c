@@ -27,6 +27,7 @@ void init_fsecs(void)
     set_fcyc_maxsamples(20); 
     set_fcyc_clear_cache(1);
     set_fcyc_compensate(1);
+    init_comp_counter();
     set_fcyc_epsilon(0.01);
     set_fcyc_k(3);
     Mhz = mhz(verbose > 0);
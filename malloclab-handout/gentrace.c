@@ -0,0 +1,295 @@
+/*
+ * gentrace.c - Generate a synthetic .rep trace for mdriver, with the
+ *     sizes and lifetimes of the blocks drawn from given distributions.
+ *     The same arguments and seed always give the same trace.
+ *
+ * usage: gentrace [-s seed] [-n ops] [-S sizes] [-L lifetimes]
+ *                 [-r prob] [-g growth] [-w weight] <out.rep>
+ *
+ * Each op frees the live block due soonest if its lifetime (in ops) is
+ * over; else, with probability prob, it reallocs a random live block to
+ * growth times its size; else it allocates a new block. Once about ops
+ * ops are out, the blocks still live are freed. A distribution is one of
+ *
+ *     fixed:X            always X
+ *     uniform:MIN:MAX    uniform in [MIN, MAX]
+ *     exp:MEAN           exponential with mean MEAN
+ *     pow:MIN:MAX:ALPHA  power law in [MIN, MAX], density ~ x^-ALPHA
+ *     bimodal:A:B:P      A with probability P, else B
+ *     never              (lifetimes only) live until the end
+ *
+ * For example, fixed lifetimes free the blocks in the order they were
+ * allocated, like a producer/consumer queue, and never builds a live set
+ * as large as the trace.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NEVER 1e300 /* lifetime of the blocks that are never freed */
+
+/* A distribution of sizes or lifetimes */
+typedef struct {
+    enum { FIXED, UNIFORM, EXP, POW, BIMODAL, NEVER_FREED } kind;
+    double a, b, c;
+} dist_t;
+
+/* An op of the trace, kept until the header can be written */
+typedef struct {
+    char type;       /* 'a', 'f' or 'r' */
+    int id;
+    size_t size;
+} op_t;
+
+/* A live block, in the heap of the next blocks to free */
+typedef struct {
+    double death;    /* op count at which the block is freed */
+    int id;
+} live_t;
+
+static uint64_t rng_state;
+
+/*
+ * rnd - Return a uniform double in [0, 1) (splitmix64).
+ */
+static double rnd(void)
+{
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * parse_dist - Parse the distribution spec s into d, or exit.
+ */
+static void parse_dist(dist_t *d, const char *s, int lifetime)
+{
+    int ok;
+
+    memset(d, 0, sizeof(*d));
+    if (strncmp(s, "fixed:", 6) == 0) {
+        d->kind = FIXED;
+        ok = sscanf(s + 6, "%lf", &d->a) == 1;
+    } else if (strncmp(s, "uniform:", 8) == 0) {
+        d->kind = UNIFORM;
+        ok = sscanf(s + 8, "%lf:%lf", &d->a, &d->b) == 2 && d->a <= d->b;
+    } else if (strncmp(s, "exp:", 4) == 0) {
+        d->kind = EXP;
+        ok = sscanf(s + 4, "%lf", &d->a) == 1 && d->a > 0;
+    } else if (strncmp(s, "pow:", 4) == 0) {
+        d->kind = POW;
+        ok = sscanf(s + 4, "%lf:%lf:%lf", &d->a, &d->b, &d->c) == 3 &&
+            d->a > 0 && d->a <= d->b;
+    } else if (strncmp(s, "bimodal:", 8) == 0) {
+        d->kind = BIMODAL;
+        ok = sscanf(s + 8, "%lf:%lf:%lf", &d->a, &d->b, &d->c) == 3 &&
+            d->c >= 0 && d->c <= 1;
+    } else {
+        d->kind = NEVER_FREED;
+        ok = lifetime && strcmp(s, "never") == 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "bad %s distribution: %s\n",
+                lifetime ? "lifetime" : "size", s);
+        exit(1);
+    }
+}
+
+/*
+ * draw - Return a value drawn from distribution d.
+ */
+static double draw(const dist_t *d)
+{
+    double u = rnd(), e;
+
+    switch (d->kind) {
+    case FIXED:
+        return d->a;
+    case UNIFORM:
+        return d->a + u * (d->b - d->a + 1);
+    case EXP:
+        return -d->a * log(1 - u);
+    case POW:
+        /* invert the distribution function of the truncated power law */
+        if (fabs(d->c - 1) < 1e-9)
+            return d->a * pow(d->b / d->a, u);
+        e = 1 - d->c;
+        return pow(pow(d->a, e) + u * (pow(d->b, e) - pow(d->a, e)), 1 / e);
+    case BIMODAL:
+        return u < d->c ? d->a : d->b;
+    default:
+        return NEVER;
+    }
+}
+
+/*
+ * grow - Resize the array *p of *cap elements of size elem to hold n.
+ */
+static void grow(void *p, size_t *cap, size_t n, size_t elem)
+{
+    if (n <= *cap)
+        return;
+    *cap = *cap ? *cap * 2 : 1024;
+    if (*cap < n)
+        *cap = n;
+    if ((*(void **)p = realloc(*(void **)p, *cap * elem)) == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+}
+
+/* Heap of the live blocks by time of death */
+static live_t *heap;
+static size_t nlive, heap_cap;
+
+static void heap_push(live_t b)
+{
+    size_t i = nlive++;
+
+    grow(&heap, &heap_cap, nlive, sizeof(live_t));
+    while (i > 0 && heap[(i - 1) / 2].death > b.death) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = b;
+}
+
+static live_t heap_pop(void)
+{
+    live_t top = heap[0], b = heap[--nlive];
+    size_t i = 0, child;
+
+    while ((child = 2 * i + 1) < nlive) {
+        if (child + 1 < nlive && heap[child + 1].death < heap[child].death)
+            child++;
+        if (b.death <= heap[child].death)
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (nlive > 0)
+        heap[i] = b;
+    return top;
+}
+
+/*
+ * usage - Explain the command line arguments and exit.
+ */
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-s seed] [-n ops] [-S sizes] [-L lifetimes] "
+            "[-r prob] [-g growth] [-w weight] <out.rep>\n", prog);
+    exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+    dist_t sizes, lifetimes;
+    op_t *ops = NULL;
+    size_t *block_sizes = NULL;
+    size_t nops = 0, ops_cap = 0, ids_cap = 0, i;
+    long target = 100000;
+    double prob = 0, growth = 1.5, size;
+    int weight = 1, nids = 0, c;
+    live_t b;
+    FILE *out;
+
+    rng_state = 1;
+    parse_dist(&sizes, "pow:16:8192:1.5", 0);
+    parse_dist(&lifetimes, "exp:1000", 1);
+    while ((c = getopt(argc, argv, "s:n:S:L:r:g:w:")) != -1) {
+        switch (c) {
+        case 's':
+            rng_state = strtoull(optarg, NULL, 0);
+            break;
+        case 'n':
+            target = atol(optarg);
+            break;
+        case 'S':
+            parse_dist(&sizes, optarg, 0);
+            break;
+        case 'L':
+            parse_dist(&lifetimes, optarg, 1);
+            break;
+        case 'r':
+            prob = atof(optarg);
+            break;
+        case 'g':
+            growth = atof(optarg);
+            break;
+        case 'w':
+            weight = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 1 || target < 1 || prob < 0 || prob > 1 ||
+        growth <= 0)
+        usage(argv[0]);
+
+    /* stop adding ops once the frees of the live blocks make the count */
+    while (nops + nlive < (size_t)target) {
+        grow(&ops, &ops_cap, nops + 1, sizeof(op_t));
+        if (nlive > 0 && (heap[0].death <= nops ||
+                          nops + nlive + 2 > (size_t)target)) {
+            b = heap_pop();
+            ops[nops].type = 'f';
+            ops[nops].id = b.id;
+            ops[nops].size = 0;
+        } else if (nlive > 0 && rnd() < prob) {
+            b = heap[(size_t)(rnd() * nlive)];
+            size = block_sizes[b.id] * growth;
+            block_sizes[b.id] = size < 1 ? 1 : (size_t)size;
+            ops[nops].type = 'r';
+            ops[nops].id = b.id;
+            ops[nops].size = block_sizes[b.id];
+        } else {
+            if (nids == INT32_MAX) {
+                fprintf(stderr, "too many blocks\n");
+                exit(1);
+            }
+            grow(&block_sizes, &ids_cap, nids + 1, sizeof(size_t));
+            size = draw(&sizes);
+            block_sizes[nids] = size < 1 ? 1 : (size_t)size;
+            b.id = nids++;
+            b.death = nops + 1 + draw(&lifetimes);
+            heap_push(b);
+            ops[nops].type = 'a';
+            ops[nops].id = b.id;
+            ops[nops].size = block_sizes[b.id];
+        }
+        nops++;
+    }
+    while (nlive > 0) {
+        grow(&ops, &ops_cap, nops + 1, sizeof(op_t));
+        ops[nops].type = 'f';
+        ops[nops].id = heap_pop().id;
+        ops[nops].size = 0;
+        nops++;
+    }
+
+    if ((out = fopen(argv[optind], "w")) == NULL) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    fprintf(out, "%d\n%d\n%zu\n%d\n", weight, nids, nops, 0);
+    for (i = 0; i < nops; i++) {
+        if (ops[i].type == 'f')
+            fprintf(out, "f %d\n", ops[i].id);
+        else
+            fprintf(out, "%c %d %zu\n", ops[i].type, ops[i].id, ops[i].size);
+    }
+    if (fclose(out) != 0) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    return 0;
+}
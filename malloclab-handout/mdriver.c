@@ -7,23 +7,56 @@
  * Copyright (c) 2004-2015, R. Bryant and D. O'Hallaron, All rights
  * reserved.  May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* for sched_setaffinity */
 #include <assert.h>
 #include <errno.h>
 #include <float.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
 #include "config.h"
+#include "repb.h"
+
+/* packages without these (mm-tlsf.c, mm-thread.c) fail 'm' and arena ops,
+   -F, -b */
+#pragma weak mm_memalign
+#pragma weak mm_free_sized
+#pragma weak mm_usable_size
+#pragma weak mm_malloc_batch
+#pragma weak mm_free_batch
+#pragma weak mm_arena_create
+#pragma weak mm_arena_alloc
+#pragma weak mm_arena_reset
+#pragma weak mm_arena_destroy
+/* only mm-thread.c defines this, and -T requires it */
+#pragma weak mm_thread_safe
+/* only mm.c built with -DTCACHE defines this, adding the hit column */
+#pragma weak mm_tcache_stats
+/* only mm.c built with -DPURGE defines this, adding the rss column */
+#pragma weak mm_purge
 
 /**********************
  * Constants and macros
@@ -33,10 +66,35 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define ALIGN_OF(op) ((size_t)1 << (op)->align) /* alignment of an 'm' op */
+#define MIN_INDEX(type) ((type) == FREE || (type) > ARENA_ALLOC ? -1 : 0)
+#define MAXTHREADS    64 /* max number of threads replaying a trace (-T) */
+#define CHUNK_OPS  65536 /* ops decoded at a time from a streamed trace */
+#define RANGE_POOL  4096 /* range records allocated at a time */
+#define MAX_BATCH    256 /* most ops replayed as one batch (-b) */
+#define MAX_ARENAS 65536 /* arena ids of a trace, which fit traceop_t */
+#define LAT_SIZES      4 /* size classes of the latency histograms (-L) */
+#define LAT_SLOWEST    5 /* slowest calls reported for each trace (-L) */
+#define HIST_SUB       4 /* log2 of the latency buckets per power of two */
+#define HIST_BUCKETS ((64 - HIST_SUB + 1) << HIST_SUB)
+#define NEVENTS        6 /* hardware events counted for each trace (-e) */
+#define EV_CYCLES      1 /* the event that falls back to the cycle counter */
+
+/* config of a perf_event cache event counting read misses of cache c */
+#define CACHE_MISSES(c) (PERF_COUNT_HW_CACHE_##c | \
+                         PERF_COUNT_HW_CACHE_OP_READ << 8 | \
+                         PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+#define UTIL_NOISE 0.001 /* drop in util from a baseline that is no regression */
+#define BASE_MIN_OPS 10000 /* fewer ops are timed too noisily to compare */
+#define BASE_RUNS 3 /* timings of each trace for --json and --baseline */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
+/* mm.c and its kin return -1 where libc returns NULL */
+#define MM_FAILED(p) ((p) == NULL || (void *)(p) == (void *)-1)
+
 /* weights */
 #define WNONE 0
 #define WALL 1
@@ -54,34 +112,96 @@
  * Remember that index (-1) is the null pointer.
  */
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload, as a node of a treap */
 typedef struct range_t {
-    char *lo;              /* low payload address */
+    char *lo;              /* low payload address, the key of the treap */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* subtree of lower payloads */
+    struct range_t *right; /* subtree of higher payloads; next free record */
+    unsigned prio;         /* random priority, at most that of the parent */
     int index;             /* same index as free; for debugging */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
+/*
+ * Characterizes a single trace operation (allocator request). The ops up
+ * to ARENA_ALLOC allocate the block of index, and those from ARENA_ALLOC
+ * on work on the arena of id arena; the other arena ops have index -1.
+ */
+enum { ALLOC, FREE, REALLOC, MEMALIGN, ARENA_ALLOC, ARENA_CREATE,
+       ARENA_RESET, ARENA_DESTROY, NUM_TYPES };
 typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
+    unsigned char type;               /* type of request */
+    unsigned char align;              /* log2 of the alignment of memalign */
+    unsigned short arena;             /* arena id of the arena ops */
     int index;                        /* index for free() to use later */
-    size_t size;                      /* byte size of alloc/realloc request */
+    size_t size;                      /* byte size of alloc/realloc request,
+                                         or chunk size of ARENA_CREATE */
 } traceop_t;
 
 /* Holds the information for one trace file*/
 typedef struct {
     char filename[MAXLINE];
-    int ignore_ranges;   /* don't check ranges (i.e. this is too big) */
+    int ignore_ranges;   /* was: too big to check ranges; now unused */
     int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
+    long num_ops;        /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
     int *block_rand_base;/* index into random_data, if debug is on */
+    int num_arenas;      /* number of arena ids */
+    mm_arena_t **arenas; /* array of the arenas by id */
+    int *arena_first;    /* the last block allocated from each arena... */
+    int *arena_next;     /* ... and, by block, the one before it (-1 ends) */
+    char *map;           /* mapping of a .repb file holding ops, or NULL */
+    size_t map_len;
+    struct stream *stream; /* reader of a streamed .repz file, or NULL */
+    traceop_t *cur;      /* the ops left in the chunk being replayed */
+    traceop_t *end;
 } trace_t;
 
+/*
+ * The ops of a streamed trace are not kept in memory: a reader thread
+ * decodes them into two buffers in turn while the other one is replayed.
+ * len is -1 for a buffer being filled, and 0 once the ops run out.
+ */
+typedef struct stream {
+    FILE *file;
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    traceop_t *buf[2];
+    long len[2];
+    int next;            /* buffer to replay next */
+    int held;            /* buffer being replayed, or -1 */
+    long handed;         /* chunks handed out since the pass began */
+    int restart;         /* set to make the reader start over */
+    int quit;            /* set to stop the reader */
+} stream_t;
+
+/* the records of a .repb file are used in place as the ops array */
+_Static_assert(sizeof(traceop_t) == sizeof(repb_op_t) &&
+               offsetof(traceop_t, align) == offsetof(repb_op_t, align) &&
+               offsetof(traceop_t, arena) == offsetof(repb_op_t, arena) &&
+               offsetof(traceop_t, index) == offsetof(repb_op_t, index) &&
+               offsetof(traceop_t, size) == offsetof(repb_op_t, size) &&
+               ALLOC == REPB_ALLOC && FREE == REPB_FREE &&
+               REALLOC == REPB_REALLOC && MEMALIGN == REPB_MEMALIGN &&
+               ARENA_ALLOC == REPB_ARENA_ALLOC &&
+               ARENA_CREATE == REPB_ARENA_CREATE &&
+               ARENA_RESET == REPB_ARENA_RESET &&
+               ARENA_DESTROY == REPB_ARENA_DESTROY,
+               "traceop_t must match repb_op_t");
+
+/* Holds the params of one thread replaying a trace (-T) */
+typedef struct {
+    trace_t *trace;
+    char **blocks;       /* this thread's ptrs returned by malloc/realloc */
+    size_t *sizes;       /* ... and their sizes, for -F */
+    mm_arena_t **arenas; /* this thread's arenas */
+    int failed;          /* a call of this thread failed */
+} replay_t;
+
 /*
  * Holds the params to the xxx_speed functions, which are timed by fcyc.
  * This struct is necessary because fcyc accepts only a pointer array
@@ -90,8 +210,23 @@ typedef struct {
 typedef struct {
     trace_t *trace;
     range_t *ranges;
+    replay_t replay[MAXTHREADS]; /* params of each thread for -T */
 } speed_t;
 
+/* Percentiles of the latency of one kind of call, in cycles (-L) */
+typedef struct {
+    long count;      /* number of calls */
+    double p50, p99, p999, max;
+} lat_t;
+
+/* One of the slowest calls of a trace (-L) */
+typedef struct {
+    long opnum;      /* the op of the call, or -1 */
+    int type;
+    size_t size;     /* size requested, or of the block freed */
+    double cycles;
+} slow_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* set in read_trace */
@@ -105,6 +240,16 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double util_end; /* live bytes at the end over the heap left then */
+    double tc_hit;   /* fraction of cache lookups served by the tcache */
+    double rss;      /* resident part of the peak heap after mm_purge(1) */
+    /* latency of the calls by type and size class, then of all sizes (-L) */
+    lat_t lat[NUM_TYPES][LAT_SIZES + 1];
+    slow_t slowest[LAT_SLOWEST]; /* slowest calls, slowest first */
+    double lat_ovhd; /* cycles of counter overhead taken off each call */
+    /* hardware events in one timed run, or -1 if not counted (-e) */
+    double events[NEVENTS];
+    int events_tsc;  /* cycles were read from the cycle counter instead */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -117,6 +262,24 @@ typedef struct {
     double tput;  /* average throughput expressed in Kops/s */
 } sum_stats_t;
 
+/* The results of one trace read back from a baseline (--baseline) */
+typedef struct {
+    char filename[MAXLINE];
+    int weight;
+    int valid;
+    double kops;
+    double util;
+} base_t;
+
+/* What a worker evaluating one trace (-j) sends back to the driver */
+typedef struct {
+    stats_t stats;
+    int errors;   /* number of errs found by the worker */
+} result_t;
+
+/* so that a worker's result is written to its pipe at once */
+_Static_assert(sizeof(result_t) <= PIPE_BUF, "result_t must fit a pipe write");
+
 /********************
  * For debugging.  If debug-mode is on, then we have each block start
  * at a "random" place (a hash of the index), and copy random data
@@ -144,6 +307,60 @@ int onetime_flag = 0;
 /* by default, no timeouts */
 static int set_timeout = 0;
 
+/* number of threads replaying each trace concurrently when timing (-T) */
+static int nthreads = 1;
+
+/* number of traces evaluated at once by forked workers (-j) */
+static int njobs = 1;
+
+/* also time each call to print the percentiles of its latency (-L) */
+static int latency = 0;
+
+/* also count hardware events while replaying each trace (-e) */
+static int count_events = 0;
+
+/* timings of each trace, of which the shortest is kept */
+static int speed_runs = 1;
+static int sized_free = 0;      /* replay frees with mm_free_sized (-F) */
+static int batch = 0;           /* replay runs of ops as batches (-b) */
+
+/* The blocks of the batch being handed out, and the frees already done */
+static void *batch_ptrs[MAX_BATCH];
+static int batch_pos, batch_end, batch_frees;
+
+/* The names of the calls of each op type, for -L and the output files */
+static const char *types[NUM_TYPES] = {
+    "malloc", "free", "realloc", "memalign",
+    "arena_alloc", "arena_create", "arena_reset", "arena_destroy"
+};
+
+/* The hardware events counted by -e, in the order of stats_t.events */
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} perf_events[NEVENTS] = {
+    { "instr", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "L1D", PERF_TYPE_HW_CACHE, CACHE_MISSES(L1D) },
+    { "LLC", PERF_TYPE_HW_CACHE, CACHE_MISSES(LL) },
+    { "brmiss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "dTLB", PERF_TYPE_HW_CACHE, CACHE_MISSES(DTLB) },
+};
+
+/* long options, which have no short form */
+enum { OPT_JSON = 256, OPT_CSV, OPT_BASELINE, OPT_THRESHOLD };
+static const struct option long_options[] = {
+    { "json", required_argument, NULL, OPT_JSON },
+    { "csv", required_argument, NULL, OPT_CSV },
+    { "baseline", required_argument, NULL, OPT_BASELINE },
+    { "threshold", required_argument, NULL, OPT_THRESHOLD },
+    { NULL, 0, NULL, 0 }
+};
+
+/* latency histograms of one trace, by type and size class (-L) */
+static long hist[NUM_TYPES][LAT_SIZES + 1][HIST_BUCKETS];
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -163,21 +380,30 @@ sum_stats_t global_mm_sum_stats;
  *********************/
 
 /* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size,
-                     const trace_t *trace, int opnum, int index);
+static int add_range(range_t **ranges, char *lo, size_t size,
+                     const trace_t *trace, long opnum, int index);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static void check_ranges(const trace_t *trace, long opnum, const range_t *r);
 
 /* These functions implement the debugging code */
 static void init_random_data(void);
-static void check_index(const trace_t *trace, int opnum, int index);
+static void check_index(const trace_t *trace, long opnum, int index);
 static void randomize_block(trace_t *trace, int index);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename);
+static int map_trace(trace_t *trace, FILE *tracefile);
+static int open_stream(trace_t *trace, FILE *tracefile);
+static void *stream_reader(void *ptr);
+static void start_ops(trace_t *trace);
+static traceop_t *next_chunk(trace_t *trace);
 static void reinit_trace(trace_t *trace);
 static void free_trace(trace_t *trace);
+static char *batch_malloc(trace_t *trace, traceop_t *op);
+static void batch_free(trace_t *trace, traceop_t *op, range_t **ranges,
+                       long opnum);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace);
@@ -186,13 +412,25 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, double *util_end);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_speed_mt(void *ptr);
+static void *replay_thread(void *ptr);
+static void eval_mm_latency(trace_t *trace, stats_t *stats);
+static void eval_mm_events(stats_t *stats, speed_t *speed_params);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printlatency(int n, stats_t *stats);
+static void printevents(int n, stats_t *stats);
+static void write_json(const char *file, int n, stats_t *stats, double ops,
+                       double secs, double util, double perfindex);
+static void write_csv(const char *file, int n, stats_t *stats, double ops,
+                      double secs, double util, double perfindex);
+static int compare_baseline(const char *file, int n, stats_t *stats,
+                            double perfindex, double threshold);
 static void usage(void);
-static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
+static void malloc_error(const trace_t *trace, long opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
 static void unix_error(const char *fmt, ...)
     __attribute__((format(printf, 1,2), noreturn));
@@ -208,6 +446,95 @@ static void timeout_handler(int sig __attribute__((unused))) {
     longjmp(timeout_jmpbuf, 1);
 }
 
+/*
+ * measure_mm_util - Measure the utilization of the mm package on a trace
+ *     it ran correctly, as trace number tracenum.
+ */
+static void measure_mm_util(trace_t *trace, int tracenum, stats_t *stats)
+{
+    if (verbose > 1)
+        printf("efficiency, ");
+    stats->util = eval_mm_util(trace, tracenum, &stats->util_end);
+    if (mm_tcache_stats != NULL) {
+        long hits, lookups;
+        mm_tcache_stats(&hits, &lookups);
+        stats->tc_hit = lookups ? (double)hits / lookups : 0;
+    }
+    if (mm_purge != NULL) {
+        size_t page = mem_pagesize();
+        mm_purge(1);
+        stats->rss = (double)mem_resident() /
+            ((mem_peak_heapsize() + page - 1) / page * page);
+    }
+}
+
+/*
+ * time_speed - Time f with fsecs speed_runs times and return the shortest
+ *     time above 0: fsecs compensates for the overhead of the clock, which
+ *     can take a short time below 0.
+ */
+static double time_speed(fsecs_test_funct f, void *argp)
+{
+    double secs = fsecs(f, argp), t;
+    int r;
+
+    for (r = 1; r < speed_runs; r++)
+        if ((t = fsecs(f, argp)) > 0 && (secs <= 0 || t < secs))
+            secs = t;
+    return secs;
+}
+
+/*
+ * measure_mm_speed - Time the mm package on a trace it ran correctly.
+ */
+static void measure_mm_speed(trace_t *trace, stats_t *stats, range_t *ranges,
+                    speed_t *speed_params)
+{
+    speed_params->trace = trace;
+    speed_params->ranges = ranges;
+    if (verbose > 1)
+        printf("and performance.\n");
+    if (nthreads > 1) {
+        int t;
+        if (trace->stream != NULL)
+            app_error("%s: -T cannot replay a streamed trace\n",
+                      trace->filename);
+        for (t = 0; t < nthreads; t++) {
+            speed_params->replay[t].trace = trace;
+            if ((speed_params->replay[t].blocks =
+                 calloc(trace->num_ids, sizeof(char *))) == NULL ||
+                (speed_params->replay[t].sizes =
+                 calloc(trace->num_ids, sizeof(size_t))) == NULL ||
+                (speed_params->replay[t].arenas =
+                 calloc(trace->num_arenas, sizeof(mm_arena_t *))) == NULL)
+                unix_error("calloc failed in measure_mm_speed");
+        }
+        for (t = 0; t < nthreads; t++)
+            speed_params->replay[t].failed = 0;
+        stats->secs = time_speed(eval_mm_speed_mt, speed_params);
+        if (count_events)
+            eval_mm_events(stats, speed_params);
+        for (t = 0; t < nthreads; t++) {
+            if (speed_params->replay[t].failed && stats->valid) {
+                printf("ERROR [trace %s]: a call of replay thread %d "
+                       "failed\n", trace->filename, t);
+                stats->valid = 0;
+                errors++;
+            }
+            free(speed_params->replay[t].blocks);
+            free(speed_params->replay[t].sizes);
+            free(speed_params->replay[t].arenas);
+        }
+    }
+    else {
+        stats->secs = time_speed(eval_mm_speed, speed_params);
+        if (count_events)
+            eval_mm_events(stats, speed_params);
+    }
+    if (latency)
+        eval_mm_latency(trace, stats);
+}
+
 /* Run the tests; return the number of tests run (may be less than
    num_tracefiles, if there's a timeout) */
 static void run_tests(int num_tracefiles, const char *tracedir,
@@ -229,7 +556,7 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         trace_t *trace;
         trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
         strcpy(mm_stats[i].filename, trace->filename);
-        mm_stats[i].ops = trace->num_ops;
+        mm_stats[i].ops = (double)trace->num_ops * nthreads;
         if(timed_out) {
             mm_stats[i].valid = 0;
         } else {
@@ -243,14 +570,8 @@ static void run_tests(int num_tracefiles, const char *tracedir,
             }
         }
         if (mm_stats[i].valid) {
-            if (verbose > 1)
-                printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
-            speed_params->trace = trace;
-            speed_params->ranges = ranges;
-            if (verbose > 1)
-                printf("and performance.\n");
-            mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+            measure_mm_util(trace, i, &mm_stats[i]);
+            measure_mm_speed(trace, &mm_stats[i], ranges, speed_params);
         }
 
         free_trace(trace);
@@ -260,13 +581,184 @@ static void run_tests(int num_tracefiles, const char *tracedir,
     }
 }
 
+/*
+ * run_worker - In a forked worker of -j, check trace number tracenum and
+ *     measure its utilization or, if cpu is not -1, time it pinned to
+ *     that CPU. Send the stats to the driver over the pipe end out.
+ */
+static void run_worker(int tracenum, const char *tracedir,
+                       const char *tracefile, range_t *ranges,
+                       speed_t *speed_params, int cpu, int out)
+{
+    result_t result;
+    trace_t *trace;
+    cpu_set_t set;
+
+    memset(&result, 0, sizeof(result));
+    mem_init();
+    trace = read_trace(&result.stats, tracedir, tracefile);
+    result.stats.ops = (double)trace->num_ops * nthreads;
+    if (cpu < 0) {
+        result.stats.valid = eval_mm_valid(trace, &ranges);
+        if (result.stats.valid)
+            measure_mm_util(trace, tracenum, &result.stats);
+    } else {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0)
+            unix_error("sched_setaffinity failed in run_worker");
+        measure_mm_speed(trace, &result.stats, ranges, speed_params);
+    }
+    result.errors = errors;
+    if (write(out, &result, sizeof(result)) != sizeof(result))
+        unix_error("write failed in run_worker");
+    _exit(0);
+}
+
+static pid_t *worker_pids;  /* the running worker of each trace, or 0 */
+
+/*
+ * run_workers - Run a worker of -j for each trace, at most jobs at once,
+ *     and merge the stats they send back into mm_stats. Timing workers
+ *     are only run for valid traces, each pinned to a CPU of its own
+ *     among those the driver may run on.
+ */
+static void run_workers(int timing, int jobs, int num_tracefiles,
+                        const char *tracedir, char **tracefiles,
+                        stats_t *mm_stats, range_t *ranges,
+                        speed_t *speed_params)
+{
+    int next = 0, running = 0;
+    int i, cpu, fd[2];
+    int *fds, *cpus;
+    cpu_set_t set;     /* the CPUs no worker is timing on */
+    result_t result;
+    pid_t pid;
+
+    if ((fds = (int *)calloc(num_tracefiles, sizeof(int))) == NULL ||
+        (cpus = (int *)calloc(num_tracefiles, sizeof(int))) == NULL)
+        unix_error("calloc failed in run_workers");
+    if (sched_getaffinity(0, sizeof(set), &set) < 0)
+        unix_error("sched_getaffinity failed in run_workers");
+
+    while (next < num_tracefiles || running > 0) {
+        while (next < num_tracefiles && running < jobs) {
+            if (timing && !mm_stats[next].valid) {
+                next++;
+                continue;
+            }
+            cpu = -1;
+            if (timing) {
+                for (cpu = 0; !CPU_ISSET(cpu, &set); cpu++)
+                    ;
+                CPU_CLR(cpu, &set);
+            }
+            if (pipe(fd) < 0)
+                unix_error("pipe failed in run_workers");
+            if ((pid = fork()) < 0)
+                unix_error("fork failed in run_workers");
+            if (pid == 0) {
+                close(fd[0]);
+                run_worker(next, tracedir, tracefiles[next], ranges,
+                           speed_params, cpu, fd[1]);
+            }
+            close(fd[1]);
+            worker_pids[next] = pid;
+            fds[next] = fd[0];
+            cpus[next] = cpu;
+            next++;
+            running++;
+        }
+        if (running == 0)
+            break;
+
+        /* collect the stats of the next worker to finish */
+        if ((pid = wait(NULL)) < 0)
+            unix_error("wait failed in run_workers");
+        for (i = 0; i < num_tracefiles && worker_pids[i] != pid; i++)
+            ;
+        if (i == num_tracefiles)
+            continue;
+        worker_pids[i] = 0;
+        running--;
+        if (timing)
+            CPU_SET(cpus[i], &set);
+        if (read(fds[i], &result, sizeof(result)) == sizeof(result)) {
+            if (timing) {
+                mm_stats[i].secs = result.stats.secs;
+                memcpy(mm_stats[i].lat, result.stats.lat,
+                       sizeof(result.stats.lat));
+                memcpy(mm_stats[i].slowest, result.stats.slowest,
+                       sizeof(result.stats.slowest));
+                mm_stats[i].lat_ovhd = result.stats.lat_ovhd;
+                memcpy(mm_stats[i].events, result.stats.events,
+                       sizeof(result.stats.events));
+                mm_stats[i].events_tsc = result.stats.events_tsc;
+            } else
+                mm_stats[i] = result.stats;
+            errors += result.errors;
+        } else {
+            printf("ERROR [trace %s]: the worker died\n",
+                   mm_stats[i].filename);
+            mm_stats[i].valid = 0;
+            errors++;
+        }
+        close(fds[i]);
+    }
+    free(fds);
+    free(cpus);
+}
+
+/*
+ * run_tests_parallel - Like run_tests, but with forked workers, each with
+ *     its own memory system. Up to njobs workers check the traces and
+ *     measure their utilization at once. Then the valid traces are timed
+ *     by workers pinned to distinct CPUs, with no other worker running.
+ */
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, stats_t *mm_stats,
+                               range_t *ranges, speed_t *speed_params)
+{
+    cpu_set_t set;
+    int i;
+
+    if ((worker_pids = (pid_t *)calloc(num_tracefiles, sizeof(pid_t))) == NULL)
+        unix_error("calloc failed in run_tests_parallel");
+
+    /* name every trace, in case its worker does not report back */
+    for (i = 0; i < num_tracefiles; i++) {
+        strcpy(mm_stats[i].filename, tracedir);
+        strcat(mm_stats[i].filename, tracefiles[i]);
+    }
+
+    /* handle timeouts: stop the workers, whose traces are left invalid */
+    if (setjmp(timeout_jmpbuf) != 0) {
+        for (i = 0; i < num_tracefiles; i++) {
+            if (worker_pids[i] > 0) {
+                kill(worker_pids[i], SIGKILL);
+                mm_stats[i].valid = 0;
+            }
+        }
+        while (wait(NULL) > 0)
+            ;
+    } else {
+        run_workers(0, njobs, num_tracefiles, tracedir, tracefiles,
+                    mm_stats, ranges, speed_params);
+        if (sched_getaffinity(0, sizeof(set), &set) < 0)
+            unix_error("sched_getaffinity failed in run_tests_parallel");
+        i = CPU_COUNT(&set);
+        run_workers(1, njobs < i ? njobs : i, num_tracefiles, tracedir,
+                    tracefiles, mm_stats, ranges, speed_params);
+    }
+    free(worker_pids);
+}
+
 /**************
  * Main routine
  **************/
 int main(int argc, char **argv)
 {
-    int i;
-    char c;
+    int i, c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
 
@@ -278,6 +770,11 @@ int main(int argc, char **argv)
     int run_libc = 0;     /* If set, run libc malloc (set by -l) */
     int autograder = 0;   /* if set then called by autograder (-A) */
     int checkpoint = 0;
+    char *json_file = NULL;     /* write the results as JSON (--json) */
+    char *csv_file = NULL;      /* write the results as CSV (--csv) */
+    char *baseline_file = NULL; /* compare against these results (--baseline) */
+    double threshold = 20;      /* percent of Kops lost that is a regression */
+    int regressions = 0;
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput = 0, p1, p2, perfindex;
@@ -291,7 +788,8 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpVAlD")) != EOF) {
+    while ((c = getopt_long(argc, argv, "d:f:c:s:t:v:T:j:behpVAlLDF",
+                            long_options, NULL)) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -332,6 +830,22 @@ int main(int argc, char **argv)
             run_libc = 1;
             break;
 
+        case 'e': /* Count hardware events while timing each trace */
+            count_events = 1;
+            break;
+
+        case 'L': /* Print the latency of the calls to the mm package */
+            latency = 1;
+            break;
+
+        case 'b': /* Replay runs of allocations, or of frees, at once */
+            batch = 1;
+            break;
+
+        case 'F': /* Tell mm_free_sized the size of each block freed */
+            sized_free = 1;
+            break;
+
         case 'V': /* Increase verbosity level */
             verbose += 1;
             break;
@@ -352,6 +866,37 @@ int main(int argc, char **argv)
             set_timeout = atoi(optarg);
             break;
 
+        case 'T': /* Replay each trace in several threads when timing */
+            nthreads = atoi(optarg);
+            if (nthreads < 1 || nthreads > MAXTHREADS)
+                app_error("-T takes a number of threads in [1, %d]\n",
+                          MAXTHREADS);
+            break;
+
+        case 'j': /* Evaluate several traces at once in forked workers */
+            njobs = atoi(optarg);
+            if (njobs < 1)
+                app_error("-j takes a positive number of workers\n");
+            break;
+
+        case OPT_JSON: /* Write the results as JSON to a file, or - */
+            json_file = optarg;
+            break;
+
+        case OPT_CSV: /* Write the results as CSV to a file, or - */
+            csv_file = optarg;
+            break;
+
+        case OPT_BASELINE: /* Flag regressions from results of --json */
+            baseline_file = optarg;
+            break;
+
+        case OPT_THRESHOLD: /* Percent of Kops lost to flag a regression */
+            threshold = atof(optarg);
+            if (threshold < 0)
+                app_error("--threshold takes a non-negative percentage\n");
+            break;
+
         case 'h': /* Print this message */
             usage();
             exit(0);
@@ -362,6 +907,14 @@ int main(int argc, char **argv)
         }
     }
 
+    if (njobs > 1 && nthreads > 1)
+        app_error("-j cannot be combined with -T\n");
+    if (nthreads > 1 && &mm_thread_safe == NULL)
+        app_error("-T needs a thread-safe malloc package "
+                  "(mdriver-thread)\n");
+    if (json_file != NULL || baseline_file != NULL)
+        speed_runs = BASE_RUNS;
+
     if (tracefiles == NULL) {
         tracefiles = default_tracefiles;
         num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
@@ -428,8 +981,12 @@ int main(int argc, char **argv)
     if (mm_stats == NULL)
         unix_error("mm_stats calloc in main failed");
 
-    run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
-              ranges, &speed_params);
+    if (njobs > 1 && !onetime_flag)
+        run_tests_parallel(num_tracefiles, tracedir, tracefiles, mm_stats,
+                           ranges, &speed_params);
+    else
+        run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
+                  ranges, &speed_params);
 
 
     /* Display the mm results in a compact table */
@@ -444,6 +1001,10 @@ int main(int argc, char **argv)
         } else {
             printf("\nResults for mm malloc:\n");
             printresults(num_tracefiles, mm_stats, &global_mm_sum_stats);
+            if (count_events)
+                printevents(num_tracefiles, mm_stats);
+            if (latency)
+                printlatency(num_tracefiles, mm_stats);
             printf("\n");
         }
     }
@@ -555,6 +1116,17 @@ int main(int argc, char **argv)
         printf("Terminated with %d errors\n", errors);
     }
 
+    /* Optionally write the results for scripts, and compare them */
+    if (json_file != NULL)
+        write_json(json_file, num_tracefiles, mm_stats, ops, secs,
+                   avg_mm_util, perfindex);
+    if (csv_file != NULL)
+        write_csv(csv_file, num_tracefiles, mm_stats, ops, secs,
+                  avg_mm_util, perfindex);
+    if (baseline_file != NULL)
+        regressions = compare_baseline(baseline_file, num_tracefiles,
+                                       mm_stats, perfindex, threshold);
+
     /* Optionally emit autoresult string */
     double raw_score = perfindex;
     double checkpoint_score = perfindex;
@@ -575,24 +1147,102 @@ int main(int argc, char **argv)
                 avg_mm_throughput/1000.0, avg_mm_util*100);
         printf("%s\n", autoresult);
     }
-    exit(0);
+    exit(regressions > 0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps
+ * The following routines manipulate the range tree, which keeps
  * track of the extent of every allocated block payload. We use the
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. It is a
+ * treap ordered by payload address, so each check takes logarithmic
+ * time, and its records come from a pool instead of one malloc each.
  ****************************************************************/
 
+static range_t *range_pool = NULL; /* free range records, linked by right */
+static unsigned range_seed = 1;    /* state of the priority generator */
+
+/*
+ * new_range - Take a range record from the pool, refilling it when empty.
+ */
+static range_t *new_range(void)
+{
+    range_t *p;
+    int i;
+
+    if (range_pool == NULL) {
+        if ((p = (range_t *)malloc(RANGE_POOL * sizeof(range_t))) == NULL)
+            unix_error("malloc error in new_range");
+        for (i = 0; i < RANGE_POOL; i++) {
+            p[i].right = range_pool;
+            range_pool = &p[i];
+        }
+    }
+    p = range_pool;
+    range_pool = p->right;
+
+    /* xorshift, so that random() stays reserved for the block data */
+    range_seed ^= range_seed << 13;
+    range_seed ^= range_seed >> 17;
+    range_seed ^= range_seed << 5;
+    p->prio = range_seed;
+    p->left = p->right = NULL;
+    return p;
+}
+
+/*
+ * insert_range - Insert record r into the subtree t; return the new root.
+ */
+static range_t *insert_range(range_t *t, range_t *r)
+{
+    range_t *c;
+
+    if (t == NULL)
+        return r;
+    if (r->lo < t->lo) {
+        c = t->left = insert_range(t->left, r);
+        if (c->prio > t->prio) {   /* rotate right */
+            t->left = c->right;
+            c->right = t;
+            return c;
+        }
+    } else {
+        c = t->right = insert_range(t->right, r);
+        if (c->prio > t->prio) {   /* rotate left */
+            t->right = c->left;
+            c->left = t;
+            return c;
+        }
+    }
+    return t;
+}
+
+/*
+ * join_ranges - Merge the subtrees a and b, where every payload in a is
+ *     below every payload in b; return the root of the result.
+ */
+static range_t *join_ranges(range_t *a, range_t *b)
+{
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+    if (a->prio > b->prio) {
+        a->right = join_ranges(a->right, b);
+        return a;
+    }
+    b->left = join_ranges(a, b->left);
+    return b;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list.
+ *     we create a range struct for this block and add it to the range tree.
  */
-static int add_range(range_t **ranges, char *lo, int size,
-                     const trace_t *trace, int opnum, int index)
+static int add_range(range_t **ranges, char *lo, size_t size,
+                     const trace_t *trace, long opnum, int index)
 {
     char *hi = lo + size - 1;
     range_t *p;
@@ -615,15 +1265,15 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* If we can't afford the linear-time loop, we check less thoroughly and
-       just assume the overlap will be caught by writing random bits. */
-    if(trace->ignore_ranges || debug_mode == DBG_NONE) return 1;
-
+    if (debug_mode == DBG_NONE) return 1;
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
+    /*
+     * The payload must not overlap any other payloads. Those in the tree
+     * are disjoint, so if one overlaps it, so does the payload just below
+     * or just above lo, and both lie on the search path of lo.
+     */
+    for (p = *ranges;  p != NULL;  p = lo < p->lo ? p->left : p->right) {
+        if (lo <= p->hi && hi >= p->lo) {
             malloc_error(trace, opnum,
                          "Payload (%p:%p) overlaps another payload (%p:%p)\n",
                          lo, hi, p->lo, p->hi);
@@ -633,15 +1283,13 @@ static int add_range(range_t **ranges, char *lo, int size,
 
     /*
      * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
+     * by taking a range struct and adding it to the range tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-        unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = new_range();
     p->lo = lo;
     p->hi = hi;
     p->index = index;
-    *ranges = p;
+    *ranges = insert_range(*ranges, p);
 
     return 1;
 }
@@ -652,15 +1300,13 @@ static int add_range(range_t **ranges, char *lo, int size,
 static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-            *prevpp = p->next;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    while ((p = *ranges) != NULL && p->lo != lo)
+        ranges = lo < p->lo ? &p->left : &p->right;
+    if (p != NULL) {
+        *ranges = join_ranges(p->left, p->right);
+        p->right = range_pool;
+        range_pool = p;
     }
 }
 
@@ -670,13 +1316,25 @@ static void remove_range(range_t **ranges, char *lo)
 static void clear_ranges(range_t **ranges)
 {
     range_t *p;
-    range_t *pnext;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    while ((p = *ranges) != NULL) {
+        clear_ranges(&p->left);
+        *ranges = p->right;
+        p->right = range_pool;
+        range_pool = p;
+    }
+}
+
+/*
+ * check_ranges - check_index every block in the subtree r, in address
+ *     order, for request opnum.
+ */
+static void check_ranges(const trace_t *trace, long opnum, const range_t *r)
+{
+    for (; r != NULL; r = r->right) {
+        check_ranges(trace, opnum, r->left);
+        check_index(trace, opnum, r->index);
     }
-    *ranges = NULL;
 }
 
 /**********************************************
@@ -713,7 +1371,7 @@ static void randomize_block(trace_t *traces, int index) {
     }
 }
 
-static void check_index(const trace_t *trace, int opnum, int index) {
+static void check_index(const trace_t *trace, long opnum, int index) {
     size_t size;
     size_t i;
     randint_t *block;
@@ -754,9 +1412,11 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     FILE *tracefile;
     trace_t *trace;
     char type[MAXLINE];
-    int index, size;
-    int max_index = 0;
-    int op_index;
+    int index;
+    unsigned arena;
+    size_t size, align;
+    int max_index = 0, max_arena = -1;
+    long op_index;
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
@@ -771,10 +1431,15 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     if ((tracefile = fopen(trace->filename, "r")) == NULL) {
         unix_error("Could not open %s in read_trace", trace->filename);
     }
-    (void)!fscanf(tracefile, "%d", &trace->weight);
-    (void)!fscanf(tracefile, "%d", &trace->num_ids);
-    (void)!fscanf(tracefile, "%d", &trace->num_ops);
-    (void)!fscanf(tracefile, "%d", &trace->ignore_ranges);
+    trace->map = NULL;
+    trace->stream = NULL;
+    trace->ops = NULL;
+    if (!map_trace(trace, tracefile) && !open_stream(trace, tracefile)) {
+        (void)!fscanf(tracefile, "%d", &trace->weight);
+        (void)!fscanf(tracefile, "%d", &trace->num_ids);
+        (void)!fscanf(tracefile, "%ld", &trace->num_ops);
+        (void)!fscanf(tracefile, "%d", &trace->ignore_ranges);
+    }
 
     if(trace->weight < 0 || trace->weight > 3) {
         app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
@@ -784,7 +1449,7 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     }
 
     /* We'll store each request line in the trace in this array */
-    if ((trace->ops =
+    if (trace->map == NULL && trace->stream == NULL && (trace->ops =
          (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
         unix_error("malloc 2 failed in read_trace");
 
@@ -804,21 +1469,28 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
         unix_error("malloc 5 failed in read_trace");
 
 
-    /* read every request line in the trace file */
+    /* read every request line in a text trace file */
     index = 0;
     op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
+    if (trace->map != NULL || trace->stream != NULL) {
+        op_index = trace->num_ops;      /* checked as they are read */
+        max_index = trace->num_ids - 1;
+    }
+    while (op_index < trace->num_ops &&
+           fscanf(tracefile, "%s", type) != EOF) {
         switch(type[0]) {
         case 'a':
-            (void)!fscanf(tracefile, "%u %u", &index, &size);
+            (void)!fscanf(tracefile, "%u %zu", &index, &size);
             trace->ops[op_index].type = ALLOC;
+            trace->ops[op_index].align = 0;
             trace->ops[op_index].index = index;
             trace->ops[op_index].size = size;
             max_index = (index > max_index) ? index : max_index;
             break;
         case 'r':
-            (void)!fscanf(tracefile, "%u %u", &index, &size);
+            (void)!fscanf(tracefile, "%u %zu", &index, &size);
             trace->ops[op_index].type = REALLOC;
+            trace->ops[op_index].align = 0;
             trace->ops[op_index].index = index;
             trace->ops[op_index].size = size;
             max_index = (index > max_index) ? index : max_index;
@@ -828,16 +1500,67 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
             trace->ops[op_index].type = FREE;
             trace->ops[op_index].index = index;
             break;
+        case 'm':
+            (void)!fscanf(tracefile, "%u %zu %zu", &index, &align, &size);
+            if (align == 0 || (align & (align - 1)) != 0)
+                app_error("%s: alignment %zu of op %ld is not a power of 2\n",
+                          trace->filename, align, op_index);
+            trace->ops[op_index].type = MEMALIGN;
+            trace->ops[op_index].align = __builtin_ctzl(align);
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].size = size;
+            max_index = (index > max_index) ? index : max_index;
+            break;
+        case 'n':
+            (void)!fscanf(tracefile, "%u %u %zu", &index, &arena, &size);
+            trace->ops[op_index].type = ARENA_ALLOC;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].size = size;
+            max_index = (index > max_index) ? index : max_index;
+            break;
+        case 'c':
+            (void)!fscanf(tracefile, "%u %zu", &arena, &size);
+            trace->ops[op_index].type = ARENA_CREATE;
+            trace->ops[op_index].index = -1;
+            trace->ops[op_index].size = size;
+            break;
+        case 'x':
+        case 'd':
+            (void)!fscanf(tracefile, "%u", &arena);
+            trace->ops[op_index].type =
+                type[0] == 'x' ? ARENA_RESET : ARENA_DESTROY;
+            trace->ops[op_index].index = -1;
+            trace->ops[op_index].size = 0;
+            break;
         default:
             app_error("Bogus type character (%c) in tracefile %s\n",
                       type[0], trace->filename);
         }
+        if (trace->ops[op_index].type >= ARENA_ALLOC) {
+            if (arena >= MAX_ARENAS)
+                app_error("%s: arena %u of op %ld is not below %d\n",
+                          trace->filename, arena, op_index, MAX_ARENAS);
+            trace->ops[op_index].arena = arena;
+            max_arena = (int)arena > max_arena ? (int)arena : max_arena;
+        }
         op_index++;
         if(op_index == trace->num_ops) break;
     }
-    fclose(tracefile);
+    if (trace->stream == NULL)
+        fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
+    if (trace->map == NULL && trace->stream == NULL)
+        trace->num_arenas = max_arena + 1;
+
+    /* and the arenas of the arena ops, with the blocks of each */
+    if ((trace->arenas =
+         calloc(trace->num_arenas, sizeof(*trace->arenas))) == NULL ||
+        (trace->arena_first =
+         calloc(trace->num_arenas, sizeof(*trace->arena_first))) == NULL ||
+        (trace->arena_next =
+         calloc(trace->num_ids, sizeof(*trace->arena_next))) == NULL)
+        unix_error("malloc 6 failed in read_trace");
 
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
@@ -847,6 +1570,326 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     return trace;
 }
 
+/*
+ * map_trace - If tracefile starts with REPB_MAGIC, read the header of
+ *     the .repb file into trace and map its records as trace->ops.
+ *     Return 0, with tracefile rewound, for a text trace.
+ */
+static int map_trace(trace_t *trace, FILE *tracefile)
+{
+    repb_header_t header;
+    struct stat st;
+    char *map;
+    int i, max_index = -1;
+
+    if (fread(&header, sizeof(header), 1, tracefile) != 1 ||
+        memcmp(header.magic, REPB_MAGIC, REPB_MAGIC_LEN) != 0) {
+        rewind(tracefile);
+        return 0;
+    }
+    if (fstat(fileno(tracefile), &st) < 0)
+        unix_error("Could not stat %s in map_trace", trace->filename);
+    if (header.num_ops < 0 || header.num_ids < 0 ||
+        header.num_arenas < 0 || header.num_arenas > MAX_ARENAS ||
+        (size_t)st.st_size !=
+        sizeof(header) + (size_t)header.num_ops * sizeof(repb_op_t))
+        app_error("%s: .repb file does not hold %d ops\n",
+                  trace->filename, header.num_ops);
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+               fileno(tracefile), 0);
+    if (map == MAP_FAILED)
+        unix_error("Could not map %s in map_trace", trace->filename);
+    trace->map = map;
+    trace->map_len = st.st_size;
+    trace->ops = (traceop_t *)(map + sizeof(header));
+    trace->weight = header.weight;
+    trace->num_ids = header.num_ids;
+    trace->num_ops = header.num_ops;
+    trace->ignore_ranges = header.ignore_ranges;
+    trace->num_arenas = header.num_arenas;
+
+    /* the ops are not parsed, but their ids must still be in range */
+    for (i = 0; i < trace->num_ops; i++) {
+        traceop_t *op = &trace->ops[i];
+        if (op->type >= NUM_TYPES || op->align > 63 ||
+            op->index >= trace->num_ids ||
+            op->index < MIN_INDEX(op->type) ||
+            (op->type >= ARENA_ALLOC && op->arena >= trace->num_arenas))
+            app_error("%s: bad record for op %d\n", trace->filename, i);
+        if (op->type != FREE && op->index > max_index)
+            max_index = op->index;
+    }
+    if (max_index != trace->num_ids - 1)
+        app_error("%s: the ops use %d of %d ids\n",
+                  trace->filename, max_index + 1, trace->num_ids);
+    return 1;
+}
+
+/*
+ * open_stream - If tracefile starts with REPZ_MAGIC, read the header of
+ *     the .repz file into trace and start a thread decoding its ops.
+ *     Return 0, with tracefile rewound, for other traces.
+ */
+static int open_stream(trace_t *trace, FILE *tracefile)
+{
+    repz_header_t header;
+    stream_t *s;
+
+    if (fread(&header, sizeof(header), 1, tracefile) != 1 ||
+        memcmp(header.magic, REPZ_MAGIC, REPB_MAGIC_LEN) != 0) {
+        rewind(tracefile);
+        return 0;
+    }
+    if (header.num_ids < 0 || header.num_ids > INT_MAX ||
+        header.num_ops < 0 ||
+        header.num_arenas < 0 || header.num_arenas > MAX_ARENAS)
+        app_error("%s: bad .repz header\n", trace->filename);
+    trace->weight = header.weight;
+    trace->num_ids = header.num_ids;
+    trace->num_ops = header.num_ops;
+    trace->ignore_ranges = header.ignore_ranges;
+    trace->num_arenas = header.num_arenas;
+
+    if ((s = (stream_t *)calloc(1, sizeof(stream_t))) == NULL ||
+        (s->buf[0] = (traceop_t *)
+         malloc(2 * CHUNK_OPS * sizeof(traceop_t))) == NULL)
+        unix_error("malloc failed in open_stream");
+    s->buf[1] = s->buf[0] + CHUNK_OPS;
+    s->file = tracefile;
+    s->len[0] = s->len[1] = -1;
+    s->held = -1;
+    s->restart = 1;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    trace->stream = s;
+    if (pthread_create(&s->reader, NULL, stream_reader, trace) != 0)
+        unix_error("pthread_create failed in open_stream");
+    return 1;
+}
+
+/*
+ * get_varint - Read the next varint of a streamed trace.
+ */
+static uint64_t get_varint(const trace_t *trace)
+{
+    uint64_t v = 0;
+    int c, shift = 0;
+
+    do {
+        if ((c = getc_unlocked(trace->stream->file)) == EOF || shift > 63)
+            app_error("%s: truncated .repz file\n", trace->filename);
+        v |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return v;
+}
+
+/*
+ * stream_reader - Decode the ops of a streamed trace into its two
+ *     buffers in turn, going back to the first op whenever start_ops
+ *     begins a new pass, until free_trace sets quit.
+ */
+static void *stream_reader(void *ptr)
+{
+    trace_t *trace = (trace_t *)ptr;
+    stream_t *s = trace->stream;
+    long i, n, opnum = 0;
+    int64_t index = 0;
+    uint64_t tag, size = 0;
+    int fill = 0;
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while (!s->quit && !s->restart && s->len[fill] >= 0)
+            pthread_cond_wait(&s->cond, &s->lock);
+        if (s->quit)
+            break;
+        if (s->restart) {
+            s->restart = 0;
+            fill = 0;
+            opnum = 0;
+            index = 0;
+            size = 0;
+            if (fseek(s->file, sizeof(repz_header_t), SEEK_SET) < 0)
+                unix_error("Could not rewind %s", trace->filename);
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        n = trace->num_ops - opnum;
+        n = n < CHUNK_OPS ? n : CHUNK_OPS;
+        for (i = 0; i < n; i++) {
+            traceop_t *op = &s->buf[fill][i];
+            tag = get_varint(trace);
+            index += UNZIGZAG(tag >> 3);
+            op->type = tag & 7;
+            op->index = index;
+            op->size = 0;
+            op->align = 0;
+            op->arena = 0;
+            if (op->type != FREE && op->type < ARENA_RESET) {
+                tag = get_varint(trace);
+                size += UNZIGZAG(tag);
+                op->size = size;
+            }
+            if (op->type == MEMALIGN)
+                op->align = get_varint(trace);
+            if (op->type >= ARENA_ALLOC) {
+                tag = get_varint(trace);
+                op->arena = tag;
+            }
+            if (op->align > 63 || index >= trace->num_ids ||
+                index < MIN_INDEX(op->type) ||
+                (op->type >= ARENA_ALLOC &&
+                 tag >= (uint64_t)trace->num_arenas))
+                app_error("%s: bad record for op %ld\n",
+                          trace->filename, opnum + i);
+        }
+
+        pthread_mutex_lock(&s->lock);
+        if (!s->restart) { /* else the chunk belongs to an old pass */
+            s->len[fill] = n;
+            opnum += n;
+            fill ^= 1;
+            pthread_cond_broadcast(&s->cond);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+/*
+ * start_ops - Begin a pass over the ops of trace, which next_op then
+ *     returns in order. A streamed trace is read again from the start
+ *     unless none of its ops were handed out yet.
+ */
+static void start_ops(trace_t *trace)
+{
+    stream_t *s = trace->stream;
+
+    batch_pos = batch_end = batch_frees = 0;
+    if (s == NULL) {
+        trace->cur = trace->ops;
+        trace->end = trace->ops + trace->num_ops;
+        return;
+    }
+    trace->cur = trace->end = NULL;
+    pthread_mutex_lock(&s->lock);
+    if (s->handed > 0) {
+        s->restart = 1;
+        s->len[0] = s->len[1] = -1;
+        s->next = 0;
+        s->held = -1;
+        s->handed = 0;
+        pthread_cond_broadcast(&s->cond);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * next_chunk - Called by next_op once the current chunk is used up: give
+ *     it back to the reader and wait for the next one. Return the first
+ *     op of that chunk, or NULL at the end of the pass.
+ */
+static traceop_t *next_chunk(trace_t *trace)
+{
+    stream_t *s = trace->stream;
+    long n;
+
+    if (s == NULL)
+        return NULL;
+    pthread_mutex_lock(&s->lock);
+    if (s->held >= 0) {
+        s->len[s->held] = -1;
+        pthread_cond_broadcast(&s->cond);
+    }
+    while (s->len[s->next] < 0)
+        pthread_cond_wait(&s->cond, &s->lock);
+    n = s->len[s->next];
+    trace->cur = s->buf[s->next];
+    trace->end = trace->cur + n;
+    s->held = s->next;
+    s->next ^= 1;
+    s->handed++;
+    pthread_mutex_unlock(&s->lock);
+    return n > 0 ? trace->cur++ : NULL;
+}
+
+/*
+ * next_op - Return the next op of the pass begun by start_ops, or NULL
+ *     once they are all replayed.
+ */
+static inline traceop_t *next_op(trace_t *trace)
+{
+    return trace->cur < trace->end ? trace->cur++ : next_chunk(trace);
+}
+
+/*
+ * batch_run - Return the number of ops from op on that -b replays as one
+ *     batch: allocations of the same size, or frees, up to MAX_BATCH and
+ *     within the chunk of op.
+ */
+static int batch_run(const trace_t *trace, const traceop_t *op)
+{
+    const traceop_t *p = op + 1;
+
+    while (p < trace->end && p - op < MAX_BATCH && p->type == op->type &&
+           (op->type == FREE || p->size == op->size))
+        p++;
+    return p - op;
+}
+
+/*
+ * batch_malloc - Serve the ALLOC op with the next block of the batch an
+ *     earlier op began, else with mm_malloc_batch for the run op begins,
+ *     or with mm_malloc if it begins none. Return NULL on error.
+ */
+static char *batch_malloc(trace_t *trace, traceop_t *op)
+{
+    int n;
+
+    if (batch_pos < batch_end)
+        return batch_ptrs[batch_pos++];
+    if ((n = batch_run(trace, op)) == 1)
+        return mm_malloc(op->size);
+    if (mm_malloc_batch(op->size, n, batch_ptrs) < 0)
+        return NULL;
+    batch_pos = 1;
+    batch_end = n;
+    return batch_ptrs[0];
+}
+
+/*
+ * batch_free - Serve the FREE op, number opnum: nothing if the batch of
+ *     an earlier op freed its block, else mm_free_batch of the blocks of
+ *     the run op begins, or mm_free if it begins none. For eval_mm_valid,
+ *     which passes its ranges, the payloads of the other blocks of the
+ *     batch are checked and their ranges removed before it is freed.
+ */
+static void batch_free(trace_t *trace, traceop_t *op, range_t **ranges,
+                       long opnum)
+{
+    int n, k;
+
+    if (batch_frees > 0) {
+        batch_frees--;
+        return;
+    }
+    if ((n = batch_run(trace, op)) == 1) {
+        mm_free(op->index < 0 ? NULL : trace->blocks[op->index]);
+        return;
+    }
+    for (k = 0; k < n; k++) {
+        batch_ptrs[k] = op[k].index < 0 ? NULL : trace->blocks[op[k].index];
+        if (ranges != NULL && k > 0) {
+            check_index(trace, opnum + k, op[k].index);
+            remove_range(ranges, batch_ptrs[k]);
+        }
+    }
+    mm_free_batch(batch_ptrs, n);
+    batch_frees = n - 1;
+}
+
 /*
  * reinit_trace - get the trace ready for another run.
  */
@@ -854,19 +1897,40 @@ static void reinit_trace(trace_t *trace)
 {
     memset(trace->blocks, 0, trace->num_ids * sizeof(*trace->blocks));
     memset(trace->block_sizes, 0, trace->num_ids * sizeof(*trace->block_sizes));
-    /* block_rand_base is unused if size is zero */
+    memset(trace->arenas, 0, trace->num_arenas * sizeof(*trace->arenas));
+    memset(trace->arena_first, -1,
+           trace->num_arenas * sizeof(*trace->arena_first));
+    /* block_rand_base is unused if size is zero, arena_next unless linked */
 }
 
 /*
- * free_trace - Free the trace record and the four arrays it points
- *              to, all of which were allocated in read_trace().
+ * free_trace - Free the trace record and the arrays it points to, all
+ *              of which were allocated in read_trace().
  */
 static void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);
+    stream_t *s = trace->stream;
+
+    if (s != NULL) {          /* stop the reader of a streamed trace... */
+        pthread_mutex_lock(&s->lock);
+        s->quit = 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+        pthread_join(s->reader, NULL);
+        fclose(s->file);
+        free(s->buf[0]);
+        free(s);
+    }
+    if (trace->map != NULL)   /* unmap or free the ops... */
+        munmap(trace->map, trace->map_len);
+    else
+        free(trace->ops);
+    free(trace->blocks);      /* and the other arrays... */
     free(trace->block_sizes);
     free(trace->block_rand_base);
+    free(trace->arenas);
+    free(trace->arena_first);
+    free(trace->arena_next);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -875,17 +1939,34 @@ static void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * check_usable - If the mm package provides mm_usable_size, check that
+ *     the block p returned by request opnum can hold its size bytes.
+ *     Return 1 if so, 0 otherwise.
+ */
+static int check_usable(trace_t *trace, long opnum, char *p, size_t size)
+{
+    size_t usable;
+
+    if (mm_usable_size == NULL || (usable = mm_usable_size(p)) >= size)
+        return 1;
+    malloc_error(trace, opnum, "mm_usable_size of a block of %zu bytes "
+                 "is %zu", size, usable);
+    return 0;
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
 static int eval_mm_valid(trace_t *trace, range_t **ranges)
 {
-    int i;
+    long i;
     int index;
     size_t size;
     char *newp;
     char *oldp;
     char *p;
+    traceop_t *op;
 
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
@@ -897,35 +1978,51 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         malloc_error(trace, 0, "mm_init failed.");
         return 0;
     }
+    if (batch && (mm_malloc_batch == NULL || mm_free_batch == NULL)) {
+        malloc_error(trace, 0, "mm_malloc_batch is not provided.");
+        return 0;
+    }
 
     /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
-        index = trace->ops[i].index;
-        size = trace->ops[i].size;
+    start_ops(trace);
+    for (i = 0;  (op = next_op(trace)) != NULL;  i++) {
+        index = op->index;
+        size = op->size;
 
         if(debug_mode == DBG_EXPENSIVE) {
-            range_t *r;
-                        
             /* Let the students check their own heap */
             mm_checkheap(verbose);
 
             /* Now check that all our allocated blocks have the right data */
-            r = *ranges;
-            while(r) {
-                check_index(trace, i, r->index);
-                r = r->next;
-            }
+            check_ranges(trace, i, *ranges);
         }
 
-        switch (trace->ops[i].type) {
+        switch (op->type) {
 
         case ALLOC: /* mm_malloc */
+        case MEMALIGN: /* mm_memalign */
 
-            /* Call the student's malloc */
-            if ((p = mm_malloc(size)) == NULL) {
-                malloc_error(trace, i, "mm_malloc failed.");
+            /* Call the student's malloc, or memalign */
+            if (op->type == ALLOC) {
+                p = batch ? batch_malloc(trace, op) : mm_malloc(size);
+            } else if (mm_memalign == NULL) {
+                malloc_error(trace, i, "mm_memalign is not provided.");
+                return 0;
+            } else {
+                p = mm_memalign(ALIGN_OF(op), size);
+            }
+            if (MM_FAILED(p)) {
+                malloc_error(trace, i, "mm_%s failed.",
+                             op->type == ALLOC ? "malloc" : "memalign");
+                return 0;
+            }
+            if (((size_t)p & (ALIGN_OF(op) - 1)) != 0) {
+                malloc_error(trace, i, "Payload address (%p) not aligned "
+                             "to %zu bytes", p, ALIGN_OF(op));
                 return 0;
             }
+            if (check_usable(trace, i, p, size) == 0)
+                return 0;
 
             /*
              * Test the range of the new block for correctness and add it
@@ -949,7 +2046,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
             /* Call the student's realloc */
             oldp = trace->blocks[index];
             newp = mm_realloc(oldp, size);
-            if( (newp == NULL) && (size != 0) ) {
+            if (MM_FAILED(newp) && size != 0) {
                 malloc_error(trace, i, "mm_realloc failed.");
                 return 0;
             }
@@ -967,6 +2064,8 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
             if (size > 0) {
                 if(add_range(ranges, newp, size, trace, i, index) == 0)
                     return 0;
+                if (check_usable(trace, i, newp, size) == 0)
+                    return 0;
             }
 
 
@@ -984,7 +2083,8 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
             break;
 
         case FREE: /* mm_free */
-            check_index(trace, i, index);
+            if (batch_frees == 0) /* else checked as its batch began */
+                check_index(trace, i, index);
 
             /* Remove region from list and call student's free function */
             if(index == -1) {
@@ -993,7 +2093,62 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
                 p = trace->blocks[index];
                 remove_range(ranges, p);
             }
-            mm_free(p);
+            if (batch) {
+                batch_free(trace, op, ranges, i);
+            } else if (sized_free && p != NULL) {
+                if (mm_free_sized == NULL) {
+                    malloc_error(trace, i, "mm_free_sized is not provided.");
+                    return 0;
+                }
+                mm_free_sized(p, trace->block_sizes[index]);
+            } else {
+                mm_free(p);
+            }
+            break;
+
+        case ARENA_CREATE: /* mm_arena_create */
+            if (mm_arena_create == NULL) {
+                malloc_error(trace, i, "mm_arena_create is not provided.");
+                return 0;
+            }
+            if ((trace->arenas[op->arena] = mm_arena_create(size)) == NULL) {
+                malloc_error(trace, i, "mm_arena_create failed.");
+                return 0;
+            }
+            break;
+
+        case ARENA_ALLOC: /* mm_arena_alloc */
+            p = mm_arena_alloc(trace->arenas[op->arena], size);
+            if (p == NULL) {
+                malloc_error(trace, i, "mm_arena_alloc failed.");
+                return 0;
+            }
+            if (add_range(ranges, p, size, trace, i, index) == 0)
+                return 0;
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            randomize_block(trace, index);
+
+            /* link it to the blocks of the arena */
+            trace->arena_next[index] = trace->arena_first[op->arena];
+            trace->arena_first[op->arena] = index;
+            break;
+
+        case ARENA_RESET: /* mm_arena_reset */
+        case ARENA_DESTROY: /* mm_arena_destroy */
+            /* the blocks of the arena must be intact until it frees them */
+            for (index = trace->arena_first[op->arena]; index >= 0;
+                 index = trace->arena_next[index]) {
+                check_index(trace, i, index);
+                remove_range(ranges, trace->blocks[index]);
+            }
+            trace->arena_first[op->arena] = -1;
+            if (op->type == ARENA_RESET) {
+                mm_arena_reset(trace->arenas[op->arena]);
+            } else {
+                mm_arena_destroy(trace->arenas[op->arena]);
+                trace->arenas[op->arena] = NULL;
+            }
             break;
 
         default:
@@ -1011,22 +2166,22 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   largest size of the heap in bytes while running the student's malloc
+ *   package on the trace. Since mem_sbrk() lets the package decrement the
+ *   brk pointer, the ratio of the bytes still live at the end of the
+ *   trace to the heap left then is stored in *util_end.
  *
  *   A higher number is better: 1 is optimal.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, double *util_end)
 {
-    int i;
     int index;
-    int size, newsize, oldsize;
-    int max_total_size = 0;
-    int total_size = 0;
+    size_t size, newsize, oldsize;
+    size_t max_total_size = 0;
+    size_t total_size = 0;
     char *p;
     char *newp, *oldp;
+    traceop_t *op;
 
     reinit_trace(trace);
 
@@ -1035,14 +2190,20 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     if (mm_init() < 0)
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    start_ops(trace);
+    while ((op = next_op(trace)) != NULL) {
+        switch (op->type) {
 
         case ALLOC: /* mm_alloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+        case MEMALIGN: /* mm_memalign */
+            index = op->index;
+            size = op->size;
 
-            if ((p = mm_malloc(size)) == NULL) {
+            if (op->type == MEMALIGN)
+                p = mm_memalign(ALIGN_OF(op), size);
+            else
+                p = batch ? batch_malloc(trace, op) : mm_malloc(size);
+            if (p == NULL) {
                 app_error("trace %d: mm_malloc failed in eval_mm_util",
                           tracenum);
             }
@@ -1055,8 +2216,8 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             break;
 
         case REALLOC: /* mm_realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+            index = op->index;
+            newsize = op->size;
             oldsize = trace->block_sizes[index];
 
             oldp = trace->blocks[index];
@@ -1073,7 +2234,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = op->index;
             if(index < 0) {
                 size = 0;
                 p = 0;
@@ -1082,11 +2243,48 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 p = trace->blocks[index];
             }
 
-            mm_free(p);
+            if (batch)
+                batch_free(trace, op, NULL, 0);
+            else if (sized_free && p != NULL)
+                mm_free_sized(p, size);
+            else
+                mm_free(p);
 
             total_size -= size;
             break;
 
+        case ARENA_CREATE: /* mm_arena_create */
+            if ((trace->arenas[op->arena] = mm_arena_create(op->size)) == NULL)
+                app_error("trace %d: mm_arena_create failed in eval_mm_util",
+                          tracenum);
+            break;
+
+        case ARENA_ALLOC: /* mm_arena_alloc */
+            index = op->index;
+            size = op->size;
+            if ((p = mm_arena_alloc(trace->arenas[op->arena], size)) == NULL)
+                app_error("trace %d: mm_arena_alloc failed in eval_mm_util",
+                          tracenum);
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            trace->arena_next[index] = trace->arena_first[op->arena];
+            trace->arena_first[op->arena] = index;
+
+            total_size += size;
+            break;
+
+        case ARENA_RESET: /* mm_arena_reset */
+        case ARENA_DESTROY: /* mm_arena_destroy */
+            for (index = trace->arena_first[op->arena]; index >= 0;
+                 index = trace->arena_next[index])
+                total_size -= trace->block_sizes[index];
+            trace->arena_first[op->arena] = -1;
+            if (op->type == ARENA_RESET)
+                mm_arena_reset(trace->arenas[op->arena]);
+            else
+                mm_arena_destroy(trace->arenas[op->arena]);
+            break;
+
         default:
             app_error("trace %d: Nonexistent request type in eval_mm_util",
                       tracenum);
@@ -1099,7 +2297,9 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 
     printf(".");
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    *util_end = mem_heapsize() ? (double)total_size / (double)mem_heapsize()
+                               : 1.0;
+    return ((double)max_total_size / (double)mem_peak_heapsize());
 }
 
 
@@ -1109,9 +2309,11 @@ static double eval_mm_util(trace_t *trace, int tracenum)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    int index;
+    size_t size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    traceop_t *op;
     reinit_trace(trace);
 
     /* Reset the heap and initialize the mm package */
@@ -1120,34 +2322,73 @@ static void eval_mm_speed(void *ptr)
         app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+    start_ops(trace);
+    while ((op = next_op(trace)) != NULL)
+        switch (op->type) {
 
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            index = op->index;
+            size = op->size;
+            p = batch ? batch_malloc(trace, op) : mm_malloc(size);
+            if (MM_FAILED(p))
                 app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case MEMALIGN: /* mm_memalign */
+            index = op->index;
+            p = mm_memalign(ALIGN_OF(op), op->size);
+            if (MM_FAILED(p))
+                app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = op->size;
             break;
 
         case REALLOC: /* mm_realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+            index = op->index;
+            newsize = op->size;
             oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
+            newp = mm_realloc(oldp,newsize);
+            if (MM_FAILED(newp) && newsize != 0)
                 app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
+            trace->block_sizes[index] = newsize;
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = op->index;
             if(index < 0) {
                 block = 0;
             } else {
                 block = trace->blocks[index];
             }
-            mm_free(block);
+            if (batch)
+                batch_free(trace, op, NULL, 0);
+            else if (sized_free && block != NULL)
+                mm_free_sized(block, trace->block_sizes[index]);
+            else
+                mm_free(block);
+            break;
+
+        case ARENA_CREATE: /* mm_arena_create */
+            if ((trace->arenas[op->arena] = mm_arena_create(op->size)) == NULL)
+                app_error("mm_arena_create error in eval_mm_speed");
+            break;
+
+        case ARENA_ALLOC: /* mm_arena_alloc */
+            if ((p = mm_arena_alloc(trace->arenas[op->arena],
+                                    op->size)) == NULL)
+                app_error("mm_arena_alloc error in eval_mm_speed");
+            trace->blocks[op->index] = p;
+            break;
+
+        case ARENA_RESET: /* mm_arena_reset */
+            mm_arena_reset(trace->arenas[op->arena]);
+            break;
+
+        case ARENA_DESTROY: /* mm_arena_destroy */
+            mm_arena_destroy(trace->arenas[op->arena]);
             break;
 
         default:
@@ -1155,6 +2396,392 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * hist_index - Return the latency bucket of v cycles. Values below
+ *     2 << HIST_SUB have a bucket each; above, each power of two is split
+ *     into 1 << HIST_SUB buckets, so a bucket is within 1/16 of its values.
+ */
+static int hist_index(unsigned long long v)
+{
+    int e;
+
+    if (v < (2 << HIST_SUB))
+        return (int)v;
+    e = 63 - __builtin_clzll(v) - HIST_SUB;
+    return (e << HIST_SUB) + (int)(v >> e);
+}
+
+/*
+ * hist_value - Return the highest number of cycles in latency bucket i.
+ */
+static double hist_value(int i)
+{
+    int e;
+
+    if (i < (2 << HIST_SUB))
+        return i;
+    e = (i >> HIST_SUB) - 1;
+    return (double)(((unsigned long long)(i - (e << HIST_SUB)) + 1) << e) - 1;
+}
+
+/*
+ * hist_percentile - Return the latency that fraction q of the calls
+ *     counted in histogram h did not exceed.
+ */
+static double hist_percentile(const long *h, long count, double q)
+{
+    long rank = (long)(q * count + 0.999999), seen = 0;
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS - 1; i++)
+        if ((seen += h[i]) >= rank)
+            break;
+    return hist_value(i);
+}
+
+/* Read the cycle counter after the calls before, and before those after */
+static inline unsigned long long read_cycles(void)
+{
+    unsigned hi, lo;
+
+    access_counter_serial(&hi, &lo);
+    return (unsigned long long)hi << 32 | lo;
+}
+
+/*
+ * record_latency - Count a call of op number opnum that took c cycles.
+ */
+static void record_latency(stats_t *stats, long opnum, int type, size_t size,
+                           unsigned long long c)
+{
+    int cls = size <= 64 ? 0 : size <= 512 ? 1 : size <= 4096 ? 2 : 3;
+    int i = hist_index(c), k;
+
+    hist[type][cls][i]++;
+    hist[type][LAT_SIZES][i]++;
+    stats->lat[type][cls].count++;
+    stats->lat[type][LAT_SIZES].count++;
+    if (c > stats->lat[type][cls].max)
+        stats->lat[type][cls].max = c;
+    if (c > stats->lat[type][LAT_SIZES].max)
+        stats->lat[type][LAT_SIZES].max = c;
+
+    /* keep the slowest calls sorted, slowest first */
+    if (c <= stats->slowest[LAT_SLOWEST - 1].cycles)
+        return;
+    for (k = LAT_SLOWEST - 1; k > 0 && c > stats->slowest[k - 1].cycles; k--)
+        stats->slowest[k] = stats->slowest[k - 1];
+    stats->slowest[k].opnum = opnum;
+    stats->slowest[k].type = type;
+    stats->slowest[k].size = size;
+    stats->slowest[k].cycles = c;
+}
+
+/*
+ * eval_mm_latency - Replay the trace once more, reading the cycle counter
+ *     around each call to the mm package, and summarize the latencies in
+ *     stats. The least time between two reads of the counter is taken
+ *     off each call as the overhead of reading it.
+ */
+static void eval_mm_latency(trace_t *trace, stats_t *stats)
+{
+    int index, type, cls, k;
+    long i;
+    size_t size;
+    char *p;
+    traceop_t *op;
+    unsigned long long start, end, ovhd = ~0ULL;
+
+    for (k = 0; k < 1000; k++) {
+        start = read_cycles();
+        end = read_cycles();
+        if (end - start < ovhd)
+            ovhd = end - start;
+    }
+    stats->lat_ovhd = ovhd;
+    memset(hist, 0, sizeof(hist));
+    memset(stats->lat, 0, sizeof(stats->lat));
+    memset(stats->slowest, 0, sizeof(stats->slowest));
+    for (k = 0; k < LAT_SLOWEST; k++)
+        stats->slowest[k].opnum = -1;
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_latency");
+
+    start_ops(trace);
+    for (i = 0; (op = next_op(trace)) != NULL; i++) {
+        index = op->index;
+        switch (op->type) {
+
+        case ALLOC: /* mm_malloc */
+            size = op->size;
+            start = read_cycles();
+            p = mm_malloc(size);
+            end = read_cycles();
+            if (p == NULL)
+                app_error("mm_malloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case MEMALIGN: /* mm_memalign */
+            size = op->size;
+            start = read_cycles();
+            p = mm_memalign(ALIGN_OF(op), size);
+            end = read_cycles();
+            if (p == NULL)
+                app_error("mm_memalign error in eval_mm_latency");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            size = op->size;
+            p = trace->blocks[index];
+            start = read_cycles();
+            p = mm_realloc(p, size);
+            end = read_cycles();
+            if (p == NULL && size != 0)
+                app_error("mm_realloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case FREE: /* mm_free */
+            p = index < 0 ? NULL : trace->blocks[index];
+            size = index < 0 ? 0 : trace->block_sizes[index];
+            if (sized_free && p != NULL) {
+                start = read_cycles();
+                mm_free_sized(p, size);
+                end = read_cycles();
+            } else {
+                start = read_cycles();
+                mm_free(p);
+                end = read_cycles();
+            }
+            break;
+
+        case ARENA_CREATE: /* mm_arena_create */
+            size = op->size;
+            start = read_cycles();
+            trace->arenas[op->arena] = mm_arena_create(size);
+            end = read_cycles();
+            if (trace->arenas[op->arena] == NULL)
+                app_error("mm_arena_create error in eval_mm_latency");
+            break;
+
+        case ARENA_ALLOC: /* mm_arena_alloc */
+            size = op->size;
+            start = read_cycles();
+            p = mm_arena_alloc(trace->arenas[op->arena], size);
+            end = read_cycles();
+            if (p == NULL)
+                app_error("mm_arena_alloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+        case ARENA_RESET: /* mm_arena_reset */
+        case ARENA_DESTROY: /* mm_arena_destroy */
+            size = 0;
+            start = read_cycles();
+            if (op->type == ARENA_RESET)
+                mm_arena_reset(trace->arenas[op->arena]);
+            else
+                mm_arena_destroy(trace->arenas[op->arena]);
+            end = read_cycles();
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_mm_latency");
+        }
+        record_latency(stats, i, op->type,
+                       size, end - start > ovhd ? end - start - ovhd : 0);
+    }
+
+    for (type = 0; type < NUM_TYPES; type++)
+        for (cls = 0; cls <= LAT_SIZES; cls++) {
+            lat_t *lat = &stats->lat[type][cls];
+            if (lat->count == 0)
+                continue;
+            lat->p50 = hist_percentile(hist[type][cls], lat->count, 0.5);
+            lat->p99 = hist_percentile(hist[type][cls], lat->count, 0.99);
+            lat->p999 = hist_percentile(hist[type][cls], lat->count, 0.999);
+            if (lat->p50 > lat->max)
+                lat->p50 = lat->max;
+            if (lat->p99 > lat->max)
+                lat->p99 = lat->max;
+            if (lat->p999 > lat->max)
+                lat->p999 = lat->max;
+        }
+}
+
+/*
+ * eval_mm_events - Replay the trace as it was timed once more, counting
+ *     the hardware events of perf_events in the replay, scaled up when
+ *     the kernel had to share the counters between them. The events that
+ *     cannot be counted are left at -1, except cycles, which are then
+ *     read from the cycle counter.
+ */
+static void eval_mm_events(stats_t *stats, speed_t *speed_params)
+{
+    struct perf_event_attr attr;
+    uint64_t val[3]; /* count, time enabled, time running */
+    int fd[NEVENTS], k;
+    double cycles;
+
+    for (k = 0; k < NEVENTS; k++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[k].type;
+        attr.config = perf_events[k].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = nthreads > 1; /* count the replay threads of -T */
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+            PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fd[k] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    /* enable and disable all the counters of this process at once */
+    prctl(PR_TASK_PERF_EVENTS_ENABLE);
+    start_counter();
+    if (nthreads > 1)
+        eval_mm_speed_mt(speed_params);
+    else
+        eval_mm_speed(speed_params);
+    cycles = get_counter();
+    prctl(PR_TASK_PERF_EVENTS_DISABLE);
+
+    for (k = 0; k < NEVENTS; k++) {
+        stats->events[k] = -1;
+        if (fd[k] < 0)
+            continue;
+        if (read(fd[k], val, sizeof(val)) == sizeof(val) && val[2] > 0)
+            stats->events[k] = (double)val[0] * val[1] / val[2];
+        close(fd[k]);
+    }
+    stats->events_tsc = stats->events[EV_CYCLES] < 0;
+    if (stats->events_tsc)
+        stats->events[EV_CYCLES] = cycles;
+}
+
+/*
+ * eval_mm_speed_mt - Like eval_mm_speed, but nthreads threads replay the
+ *    trace concurrently, each with its own set of blocks. Only meaningful
+ *    for thread-safe malloc packages such as mm-thread.c.
+ */
+static void eval_mm_speed_mt(void *ptr)
+{
+    speed_t *params = (speed_t *)ptr;
+    pthread_t tid[MAXTHREADS];
+    int t;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_speed_mt");
+
+    for (t = 0; t < nthreads; t++) {
+        memset(params->replay[t].blocks, 0,
+               params->trace->num_ids * sizeof(char *));
+        if (pthread_create(&tid[t], NULL, replay_thread,
+                           &params->replay[t]) != 0)
+            unix_error("pthread_create failed in eval_mm_speed_mt");
+    }
+    for (t = 0; t < nthreads; t++)
+        pthread_join(tid[t], NULL);
+}
+
+/*
+ * replay_thread - Interpret each request of the trace being timed by
+ *    eval_mm_speed_mt, keeping the blocks in this thread's own array.
+ *    Stop at the first call that fails, and mark the thread failed.
+ */
+static void *replay_thread(void *ptr)
+{
+    long i;
+    int index;
+    char *p, *newp;
+    replay_t *replay = (replay_t *)ptr;
+    char **blocks = replay->blocks;
+    size_t *sizes = replay->sizes;
+    mm_arena_t **arenas = replay->arenas;
+    trace_t *trace = replay->trace;
+
+    for (i = 0;  i < trace->num_ops && !replay->failed;  i++) {
+        index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            p = mm_malloc(trace->ops[i].size);
+            if (MM_FAILED(p)) {
+                replay->failed = 1;
+                break;
+            }
+            blocks[index] = p;
+            sizes[index] = trace->ops[i].size;
+            break;
+
+        case MEMALIGN: /* mm_memalign */
+            p = mm_memalign(ALIGN_OF(&trace->ops[i]), trace->ops[i].size);
+            if (MM_FAILED(p)) {
+                replay->failed = 1;
+                break;
+            }
+            blocks[index] = p;
+            sizes[index] = trace->ops[i].size;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            newp = mm_realloc(blocks[index], trace->ops[i].size);
+            if (MM_FAILED(newp) && trace->ops[i].size != 0) {
+                replay->failed = 1;
+                break;
+            }
+            blocks[index] = newp;
+            sizes[index] = trace->ops[i].size;
+            break;
+
+        case FREE: /* mm_free */
+            if (sized_free && index >= 0 && blocks[index] != NULL)
+                mm_free_sized(blocks[index], sizes[index]);
+            else
+                mm_free(index < 0 ? NULL : blocks[index]);
+            break;
+
+        case ARENA_CREATE: /* mm_arena_create */
+            if ((arenas[trace->ops[i].arena] =
+                 mm_arena_create(trace->ops[i].size)) == NULL)
+                replay->failed = 1;
+            break;
+
+        case ARENA_ALLOC: /* mm_arena_alloc */
+            if ((p = mm_arena_alloc(arenas[trace->ops[i].arena],
+                                    trace->ops[i].size)) == NULL) {
+                replay->failed = 1;
+                break;
+            }
+            blocks[index] = p;
+            break;
+
+        case ARENA_RESET: /* mm_arena_reset */
+            mm_arena_reset(arenas[trace->ops[i].arena]);
+            break;
+
+        case ARENA_DESTROY: /* mm_arena_destroy */
+            mm_arena_destroy(arenas[trace->ops[i].arena]);
+            break;
+
+        default:
+            app_error("Nonexistent request type in replay_thread");
+        }
+    }
+    return NULL;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1163,40 +2790,73 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace)
 {
-    int i, newsize;
+    long i;
+    int index;
+    size_t newsize;
     char *p, *newp, *oldp;
+    traceop_t *op;
 
     reinit_trace(trace);
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    start_ops(trace);
+    for (i = 0;  (op = next_op(trace)) != NULL;  i++) {
+        switch (op->type) {
 
         case ALLOC: /* malloc */
-            if ((p = malloc(trace->ops[i].size)) == NULL) {
+            if ((p = malloc(op->size)) == NULL) {
                 malloc_error(trace, i, "libc malloc failed");
                 unix_error("System message");
             }
-            trace->blocks[trace->ops[i].index] = p;
+            trace->blocks[op->index] = p;
+            break;
+
+        case MEMALIGN: /* aligned_alloc */
+            if ((p = aligned_alloc(ALIGN_OF(op), op->size)) == NULL) {
+                malloc_error(trace, i, "libc aligned_alloc failed");
+                unix_error("System message");
+            }
+            trace->blocks[op->index] = p;
             break;
 
         case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-            oldp = trace->blocks[trace->ops[i].index];
+            newsize = op->size;
+            oldp = trace->blocks[op->index];
             if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0) {
                 malloc_error(trace, i, "libc realloc failed");
                 unix_error("System message");
             }
-            trace->blocks[trace->ops[i].index] = newp;
+            trace->blocks[op->index] = newp;
             break;
 
         case FREE: /* free */
-            if(trace->ops[i].index >= 0) {
-                free(trace->blocks[trace->ops[i].index]);
+            if(op->index >= 0) {
+                free(trace->blocks[op->index]);
             } else {
                 free(0);
             }
             break;
 
+        case ARENA_ALLOC: /* malloc, as libc has no arenas... */
+            if ((p = malloc(op->size)) == NULL) {
+                malloc_error(trace, i, "libc malloc failed");
+                unix_error("System message");
+            }
+            trace->blocks[op->index] = p;
+            trace->arena_next[op->index] = trace->arena_first[op->arena];
+            trace->arena_first[op->arena] = op->index;
+            break;
+
+        case ARENA_RESET: /* ... so free each of their blocks */
+        case ARENA_DESTROY:
+            for (index = trace->arena_first[op->arena]; index >= 0;
+                 index = trace->arena_next[index])
+                free(trace->blocks[index]);
+            trace->arena_first[op->arena] = -1;
+            break;
+
+        case ARENA_CREATE:
+            break;
+
         default:
             app_error("invalid operation type  in eval_libc_valid");
         }
@@ -1212,26 +2872,35 @@ static int eval_libc_valid(trace_t *trace)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
-    int index, size, newsize;
+    int index;
+    size_t size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    traceop_t *op;
 
     reinit_trace(trace);
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    start_ops(trace);
+    while ((op = next_op(trace)) != NULL) {
+        switch (op->type) {
         case ALLOC: /* malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = op->index;
+            size = op->size;
             if ((p = malloc(size)) == NULL)
                 unix_error("malloc failed in eval_libc_speed");
             trace->blocks[index] = p;
             break;
 
+        case MEMALIGN: /* aligned_alloc */
+            index = op->index;
+            if ((p = aligned_alloc(ALIGN_OF(op), op->size)) == NULL)
+                unix_error("aligned_alloc failed in eval_libc_speed");
+            trace->blocks[index] = p;
+            break;
+
         case REALLOC: /* realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+            index = op->index;
+            newsize = op->size;
             oldp = trace->blocks[index];
             if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0)
                 unix_error("realloc failed in eval_libc_speed\n");
@@ -1240,7 +2909,7 @@ static void eval_libc_speed(void *ptr)
             break;
 
         case FREE: /* free */
-            index = trace->ops[i].index;
+            index = op->index;
             if(index >= 0) {
                 block = trace->blocks[index];
                 free(block);
@@ -1248,6 +2917,23 @@ static void eval_libc_speed(void *ptr)
                 free(0);
             }
             break;
+
+        case ARENA_ALLOC: /* malloc, as libc has no arenas... */
+            index = op->index;
+            if ((p = malloc(op->size)) == NULL)
+                unix_error("malloc failed in eval_libc_speed");
+            trace->blocks[index] = p;
+            trace->arena_next[index] = trace->arena_first[op->arena];
+            trace->arena_first[op->arena] = index;
+            break;
+
+        case ARENA_RESET: /* ... so free each of their blocks */
+        case ARENA_DESTROY:
+            for (index = trace->arena_first[op->arena]; index >= 0;
+                 index = trace->arena_next[index])
+                free(trace->blocks[index]);
+            trace->arena_first[op->arena] = -1;
+            break;
         }
     }
 }
@@ -1275,8 +2961,13 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     char wstr;
 
     /* Print the individual results for each trace */
-    printf("  %2s%6s %5s%8s%9s  %s\n",
-           "valid", "util", "ops", "secs", "Kops", "trace");
+    printf("  %2s%6s %5s%8s%9s%7s",
+           "valid", "util", "ops", "secs", "Kops", "end");
+    if (mm_tcache_stats != NULL)
+        printf("%7s", "hit");
+    if (mm_purge != NULL)
+        printf("%7s", "rss");
+    printf("  %s\n", "trace");
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
             switch(stats[i].weight)
@@ -1318,6 +3009,27 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
             else
                 printf("%8s%10s%6s", "--", "--", "--");
 
+            /* print the utilization against the final heap (only for mm) */
+            if (sumstats == &global_mm_sum_stats)
+                printf(" %5.0f%%", stats[i].util_end * 100.0);
+            else
+                printf(" %6s", "--");
+
+            /* print the tcache hit rate (only known for mm) */
+            if (mm_tcache_stats != NULL) {
+                if (sumstats == &global_mm_sum_stats)
+                    printf(" %5.1f%%", stats[i].tc_hit * 100.0);
+                else
+                    printf(" %6s", "--");
+            }
+            /* print the resident part of the peak heap (only known for mm) */
+            if (mm_purge != NULL) {
+                if (sumstats == &global_mm_sum_stats)
+                    printf(" %5.0f%%", stats[i].rss * 100.0);
+                else
+                    printf(" %6s", "--");
+            }
+
             printf(" %s\n", stats[i].filename);
 
             if(stats[i].weight == WALL || stats[i].weight == WPERF)
@@ -1409,26 +3121,446 @@ void unix_error(const char *fmt, ...) {
 /*
  * malloc_error - Report an error returned by the mm_malloc package
  */
-void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
+void malloc_error(const trace_t *trace, long opnum, const char *fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
 
     errors++;
 
-    printf("ERROR [trace %s, line %d]: ", trace->filename, LINENUM(opnum));
+    printf("ERROR [trace %s, line %ld]: ", trace->filename, LINENUM(opnum));
     vprintf(fmt, ap);
     putchar('\n');
 
     va_end(ap);
 }
 
+/*
+ * printlatency - Print the latency percentiles of the mm package on each
+ *     valid trace, by type and size class of the calls, and its slowest
+ *     calls with their line in the trace.
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    static const char *sizes[] = { "<=64", "<=512", "<=4K", ">4K", "all" };
+    int i, type, cls, k;
+
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("\nLatency in cycles of %s (%.0f taken off each call):\n",
+               stats[i].filename, stats[i].lat_ovhd);
+        printf("  %-14s%6s%9s%8s%8s%8s%10s\n",
+               "call", "size", "count", "p50", "p99", "p999", "max");
+        for (type = 0; type < NUM_TYPES; type++)
+            for (cls = 0; cls <= LAT_SIZES; cls++) {
+                lat_t *lat = &stats[i].lat[type][cls];
+                if (lat->count == 0)
+                    continue;
+                printf("  %-14s%6s%9ld%8.0f%8.0f%8.0f%10.0f\n",
+                       types[type], sizes[cls], lat->count,
+                       lat->p50, lat->p99, lat->p999, lat->max);
+            }
+        for (k = 0; k < LAT_SLOWEST && stats[i].slowest[k].opnum >= 0; k++)
+            printf("  %s line %ld: %s of %zu bytes, %.0f cycles\n",
+                   k == 0 ? "slowest" : "       ",
+                   LINENUM(stats[i].slowest[k].opnum),
+                   types[stats[i].slowest[k].type],
+                   stats[i].slowest[k].size, stats[i].slowest[k].cycles);
+    }
+}
+
+/*
+ * printevents - Print the hardware events per op of the mm package on
+ *     each valid trace, then over all of them.
+ */
+static void printevents(int n, stats_t *stats)
+{
+    double sum[NEVENTS], sumops = 0;
+    int i, k, tsc = 0;
+
+    printf("\nHardware events per op (misses are read misses):\n");
+    for (k = 0; k < NEVENTS; k++) {
+        printf("%8s", perf_events[k].name);
+        sum[k] = 0;
+    }
+    printf("  %s\n", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        for (k = 0; k < NEVENTS; k++) {
+            if (stats[i].events[k] < 0 || sum[k] < 0)
+                sum[k] = -1;
+            else
+                sum[k] += stats[i].events[k];
+            if (stats[i].events[k] < 0)
+                printf("%8s", "--");
+            else
+                printf("%8.2f", stats[i].events[k] / stats[i].ops);
+        }
+        printf("  %s\n", stats[i].filename);
+        sumops += stats[i].ops;
+        tsc |= stats[i].events_tsc;
+    }
+    if (sumops == 0)
+        return;
+    for (k = 0; k < NEVENTS; k++) {
+        if (sum[k] < 0)
+            printf("%8s", "--");
+        else
+            printf("%8.2f", sum[k] / sumops);
+    }
+    printf("  %s\n", "all");
+    if (tsc)
+        printf("Hardware counters not available: cycles read from the "
+               "cycle counter\n");
+}
+
+/*
+ * open_output - Open file for writing results, or stdout if it is "-".
+ */
+static FILE *open_output(const char *file)
+{
+    FILE *fp;
+
+    if (strcmp(file, "-") == 0)
+        return stdout;
+    if ((fp = fopen(file, "w")) == NULL)
+        unix_error("Could not open %s in open_output", file);
+    return fp;
+}
+
+/*
+ * close_output - Close a file opened by open_output.
+ */
+static void close_output(FILE *fp, const char *file)
+{
+    if (fp == stdout)
+        fflush(fp);
+    else if (fclose(fp) != 0)
+        unix_error("Could not write %s in close_output", file);
+}
+
+/*
+ * kops - Return the throughput of ops run in secs, in Kops/s.
+ */
+static double kops(double ops, double secs)
+{
+    return secs > 0 ? ops / 1e3 / secs : 0;
+}
+
+/*
+ * put_json_string - Write s to fp as a JSON string.
+ */
+static void put_json_string(FILE *fp, const char *s)
+{
+    putc('"', fp);
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(fp, "\\%c", *s);
+        else if ((unsigned char)*s < ' ')
+            fprintf(fp, "\\u%04x", *s);
+        else
+            putc(*s, fp);
+    }
+    putc('"', fp);
+}
+
+/*
+ * write_json - Write every stat of the mm package on each trace, and the
+ *     totals and perf index, as a JSON object to file. The fields of -e
+ *     and -L are only written when they were measured. --baseline reads
+ *     these files back.
+ */
+static void write_json(const char *file, int n, stats_t *stats, double ops,
+                       double secs, double util, double perfindex)
+{
+    static const char *sizes[] = { "<=64", "<=512", "<=4K", ">4K", "all" };
+    FILE *fp = open_output(file);
+    int i, k, type, cls;
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"perfindex\": %.2f,\n", perfindex);
+    fprintf(fp, "  \"errors\": %d,\n", errors);
+    fprintf(fp, "  \"ops\": %.0f,\n", ops);
+    fprintf(fp, "  \"secs\": %.9f,\n", secs);
+    fprintf(fp, "  \"kops\": %.1f,\n", kops(ops, secs));
+    fprintf(fp, "  \"util\": %.6f,\n", util);
+    fprintf(fp, "  \"traces\": [");
+    for (i = 0; i < n; i++) {
+        fprintf(fp, "%s\n    {\"trace\": ", i ? "," : "");
+        put_json_string(fp, stats[i].filename);
+        fprintf(fp, ", \"weight\": %d, \"valid\": %d, \"ops\": %.0f, "
+                "\"secs\": %.9f, \"kops\": %.1f, \"util\": %.6f, "
+                "\"util_end\": %.6f", stats[i].weight, stats[i].valid,
+                stats[i].ops, stats[i].secs,
+                kops(stats[i].ops, stats[i].secs),
+                stats[i].util, stats[i].util_end);
+        if (mm_tcache_stats != NULL)
+            fprintf(fp, ", \"tc_hit\": %.6f", stats[i].tc_hit);
+        if (mm_purge != NULL)
+            fprintf(fp, ", \"rss\": %.6f", stats[i].rss);
+        if (count_events) {
+            fprintf(fp, ",\n     \"events\": {");
+            for (k = 0; k < NEVENTS; k++) {
+                fprintf(fp, "%s\"%s\": ", k ? ", " : "", perf_events[k].name);
+                if (stats[i].events[k] < 0)
+                    fprintf(fp, "null");
+                else
+                    fprintf(fp, "%.0f", stats[i].events[k]);
+            }
+            fprintf(fp, "}, \"events_tsc\": %d", stats[i].events_tsc);
+        }
+        if (latency) {
+            fprintf(fp, ",\n     \"lat_ovhd\": %.0f, \"latency\": {",
+                    stats[i].lat_ovhd);
+            for (type = 0; type < NUM_TYPES; type++) {
+                fprintf(fp, "%s\n      \"%s\": {", type ? "," : "",
+                        types[type]);
+                for (cls = 0; cls <= LAT_SIZES; cls++) {
+                    lat_t *lat = &stats[i].lat[type][cls];
+                    fprintf(fp, "%s\"%s\": {\"count\": %ld, \"p50\": %.0f, "
+                            "\"p99\": %.0f, \"p999\": %.0f, \"max\": %.0f}",
+                            cls ? ", " : "", sizes[cls], lat->count,
+                            lat->p50, lat->p99, lat->p999, lat->max);
+                }
+                fprintf(fp, "}");
+            }
+            fprintf(fp, "},\n     \"slowest\": [");
+            for (k = 0; k < LAT_SLOWEST && stats[i].slowest[k].opnum >= 0; k++)
+                fprintf(fp, "%s{\"line\": %ld, \"call\": \"%s\", "
+                        "\"size\": %zu, \"cycles\": %.0f}", k ? ", " : "",
+                        LINENUM(stats[i].slowest[k].opnum),
+                        types[stats[i].slowest[k].type],
+                        stats[i].slowest[k].size, stats[i].slowest[k].cycles);
+            fprintf(fp, "]");
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    close_output(fp, file);
+}
+
+/*
+ * write_csv - Write the stats of the mm package on each trace as a CSV
+ *     table to file, with a last row named "all" holding the totals and
+ *     the perf index. Only the latency of all sizes is written for -L.
+ */
+static void write_csv(const char *file, int n, stats_t *stats, double ops,
+                      double secs, double util, double perfindex)
+{
+    FILE *fp = open_output(file);
+    int i, k, type;
+
+    fprintf(fp, "trace,weight,valid,ops,secs,kops,util,util_end");
+    if (mm_tcache_stats != NULL)
+        fprintf(fp, ",tc_hit");
+    if (mm_purge != NULL)
+        fprintf(fp, ",rss");
+    if (count_events)
+        for (k = 0; k < NEVENTS; k++)
+            fprintf(fp, ",%s", perf_events[k].name);
+    if (latency)
+        for (type = 0; type < NUM_TYPES; type++)
+            fprintf(fp, ",%s_count,%s_p50,%s_p99,%s_p999,%s_max", types[type],
+                    types[type], types[type], types[type], types[type]);
+    fprintf(fp, ",perfindex\n");
+
+    for (i = 0; i < n; i++) {
+        /* quote the name, doubling any quote in it */
+        const char *s;
+        putc('"', fp);
+        for (s = stats[i].filename; *s != '\0'; s++) {
+            if (*s == '"')
+                putc('"', fp);
+            putc(*s, fp);
+        }
+        fprintf(fp, "\",%d,%d,%.0f,%.9f,%.1f,%.6f,%.6f", stats[i].weight,
+                stats[i].valid, stats[i].ops, stats[i].secs,
+                kops(stats[i].ops, stats[i].secs),
+                stats[i].util, stats[i].util_end);
+        if (mm_tcache_stats != NULL)
+            fprintf(fp, ",%.6f", stats[i].tc_hit);
+        if (mm_purge != NULL)
+            fprintf(fp, ",%.6f", stats[i].rss);
+        if (count_events)
+            for (k = 0; k < NEVENTS; k++) {
+                if (stats[i].events[k] < 0)
+                    fprintf(fp, ",");
+                else
+                    fprintf(fp, ",%.0f", stats[i].events[k]);
+            }
+        if (latency)
+            for (type = 0; type < NUM_TYPES; type++) {
+                lat_t *lat = &stats[i].lat[type][LAT_SIZES];
+                fprintf(fp, ",%ld,%.0f,%.0f,%.0f,%.0f", lat->count,
+                        lat->p50, lat->p99, lat->p999, lat->max);
+            }
+        fprintf(fp, ",\n");
+    }
+
+    fprintf(fp, "all,,%d,%.0f,%.9f,%.1f,%.6f,", errors == 0, ops, secs,
+            kops(ops, secs), util);
+    if (mm_tcache_stats != NULL)
+        fprintf(fp, ",");
+    if (mm_purge != NULL)
+        fprintf(fp, ",");
+    if (count_events)
+        for (k = 0; k < NEVENTS; k++)
+            fprintf(fp, ",");
+    if (latency)
+        for (k = 0; k < 3 * 5; k++)
+            fprintf(fp, ",");
+    fprintf(fp, ",%.2f\n", perfindex);
+    close_output(fp, file);
+}
+
+/*
+ * json_number - Return the number after key in the JSON text s, or
+ *     -1 if s does not have key.
+ */
+static double json_number(const char *s, const char *key)
+{
+    char pattern[MAXLINE];
+    const char *p;
+
+    sprintf(pattern, "\"%s\": ", key);
+    if ((p = strstr(s, pattern)) == NULL)
+        return -1;
+    return atof(p + strlen(pattern));
+}
+
+/*
+ * read_baseline - Read the results of each trace from file, written by
+ *     write_json, into a new array; set *nbase to its length and
+ *     *perfindex to the perf index of the baseline. This is no general
+ *     JSON parser: it relies on the layout of write_json.
+ */
+static base_t *read_baseline(const char *file, int *nbase, double *perfindex)
+{
+    static const char key[] = "{\"trace\": \"";
+    FILE *fp;
+    struct stat st;
+    char *text, *p, *next, *name;
+    base_t *base = NULL;
+    int n = 0;
+
+    if ((fp = fopen(file, "r")) == NULL || fstat(fileno(fp), &st) < 0)
+        unix_error("Could not open %s in read_baseline", file);
+    if ((text = malloc(st.st_size + 1)) == NULL)
+        unix_error("malloc failed in read_baseline");
+    if (fread(text, 1, st.st_size, fp) != (size_t)st.st_size)
+        unix_error("Could not read %s in read_baseline", file);
+    text[st.st_size] = '\0';
+    fclose(fp);
+
+    if ((p = strstr(text, "\"traces\": [")) == NULL)
+        app_error("%s is not a results file written by --json\n", file);
+    *p = '\0';
+    *perfindex = json_number(text, "perfindex");
+
+    for (p = strstr(p + 1, key); p != NULL; p = next) {
+        if ((base = realloc(base, (n + 1) * sizeof(base_t))) == NULL)
+            unix_error("realloc failed in read_baseline");
+
+        /* unquote the name of the trace */
+        name = base[n].filename;
+        for (p += strlen(key); *p != '"' && *p != '\0'; p++) {
+            if (*p == '\\' && p[1] != '\0')
+                p++;
+            if (name < base[n].filename + MAXLINE - 1)
+                *name++ = *p;
+        }
+        *name = '\0';
+
+        /* the stats of this trace run up to the next trace */
+        if ((next = strstr(p, key)) != NULL)
+            *next = '\0';
+        base[n].weight = (int)json_number(p, "weight");
+        base[n].valid = json_number(p, "valid") > 0;
+        base[n].kops = json_number(p, "kops");
+        base[n].util = json_number(p, "util");
+        if (next != NULL)
+            *next = key[0];
+        n++;
+    }
+    free(text);
+    *nbase = n;
+    return base;
+}
+
+/*
+ * compare_baseline - Compare the stats of the mm package on each trace
+ *     with the baseline results written to file by --json, and return
+ *     the number of regressions: traces that are no longer valid, lost
+ *     more than threshold percent of their Kops, or lost utilization.
+ *     As in the perf index, Kops count only for traces weighted for
+ *     throughput, and of at least BASE_MIN_OPS ops, and util only for
+ *     traces weighted for utilization; the other columns show --.
+ */
+static int compare_baseline(const char *file, int n, stats_t *stats,
+                            double perfindex, double threshold)
+{
+    base_t *base;
+    double base_perfindex, cur_kops;
+    int nbase, i, j, by_kops, by_util, bad, regressions = 0;
+    char kops_change[16], util_change[16];
+
+    base = read_baseline(file, &nbase, &base_perfindex);
+    printf("\nComparison with the baseline %s (! marks a loss of over "
+           "%.1f%% Kops or of util):\n", file, threshold);
+    printf("   %8s%8s%8s%7s%7s%7s  %s\n",
+           "Kops", "base", "change", "util", "base", "change", "trace");
+    for (i = 0; i < n; i++) {
+        /* a trace may be listed twice: match it at the same place first */
+        if (i < nbase && strcmp(base[i].filename, stats[i].filename) == 0)
+            j = i;
+        else
+            for (j = 0; j < nbase; j++)
+                if (strcmp(base[j].filename, stats[i].filename) == 0)
+                    break;
+        if (j == nbase || !base[j].valid) {
+            printf("   %8s%8s%8s%7s%7s%7s  %s\n", "--", "--", "--",
+                   "--", "--", "--", stats[i].filename);
+            continue;
+        }
+        if (!stats[i].valid) {
+            printf(" ! %8s%8.0f%8s%7s%6.0f%%%7s  %s\n", "no", base[j].kops,
+                   "--", "no", base[j].util * 100, "--", stats[i].filename);
+            regressions++;
+            continue;
+        }
+        cur_kops = kops(stats[i].ops, stats[i].secs);
+        by_kops = (base[j].weight == WALL || base[j].weight == WPERF) &&
+            stats[i].ops >= BASE_MIN_OPS && base[j].kops > 0 && cur_kops > 0;
+        by_util = base[j].weight == WALL || base[j].weight == WUTIL;
+        bad = (by_kops && cur_kops < base[j].kops * (1 - threshold / 100)) ||
+            (by_util && stats[i].util < base[j].util - UTIL_NOISE);
+        strcpy(kops_change, "--");
+        strcpy(util_change, "--");
+        if (by_kops)
+            sprintf(kops_change, "%+.1f%%",
+                    (cur_kops / base[j].kops - 1) * 100);
+        if (by_util)
+            sprintf(util_change, "%+.1f", (stats[i].util - base[j].util) * 100);
+        printf(" %c %8.0f%8.0f%8s%6.0f%%%6.0f%%%7s  %s\n",
+               bad ? '!' : ' ', cur_kops, base[j].kops, kops_change,
+               stats[i].util * 100, base[j].util * 100, util_change,
+               stats[i].filename);
+        regressions += bad;
+    }
+    printf("Perf index = %.0f (baseline %.0f), %d regressions\n",
+           perfindex, base_perfindex, regressions);
+    free(base);
+    return regressions;
+}
+
 /*
  * usage - Explain the command line arguments
  */
 static void usage(void)
 {
-    fprintf(stderr, "Usage: mdriver [-hlVdD] [-f <file>]\n");
+    fprintf(stderr, "Usage: mdriver [-behlLFVdD] [-f <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-p         Calculate Checkpoint Score.\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
@@ -1436,9 +3568,20 @@ static void usage(void)
     fprintf(stderr, "\t-c <file>  Run trace file <file> once, check for correctness only.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-e         Count hardware events (cache misses...) per op.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print the latency percentiles of each call.\n");
+    fprintf(stderr, "\t-F         Free each block with mm_free_sized and its size.\n");
+    fprintf(stderr, "\t-b         Replay runs of same-size mallocs, or of frees, as batches.\n");
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
+    fprintf(stderr, "\t-T <n>     Time each trace replayed by n threads at once.\n");
+    fprintf(stderr, "\t           Only for thread-safe packages (mdriver-thread).\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to n traces at once in forked workers.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t--json <file>     Write the results as JSON (- for stdout).\n");
+    fprintf(stderr, "\t--csv <file>      Write the results as CSV (- for stdout).\n");
+    fprintf(stderr, "\t--baseline <file> Flag regressions from the results of --json.\n");
+    fprintf(stderr, "\t--threshold <pct> Loss of Kops flagged by --baseline (default 20).\n");
 }
@@ -20,20 +20,35 @@
 static char *heap;
 static char *mem_brk;
 static char *mem_max_addr;
+static char *mem_peak_brk;			/* highest brk since the last reset */
+#ifdef LIBMM
+static char *mem_commit;			/* end of the pages made writable */
+#define COMMIT_CHUNK (1UL<<20)		/* granularity of mem_commit */
+#endif
 
 /* 
- * mem_init - initialize the memory system model
+ * mem_init - initialize the memory system model. For libmm.so, reserve
+ *		MAX_HEAP bytes of address space anywhere, which mem_sbrk makes
+ *		writable as the heap grows.
  */
 void mem_init(void){
+#ifdef LIBMM
+	heap = mmap(NULL, MAX_HEAP, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (heap == MAP_FAILED)
+		heap = NULL;
+	mem_commit = heap;
+#else
 	int dev_zero = open("/dev/zero", O_RDWR);
 	heap = mmap((void *)0x800000000, /* suggested start*/
 			MAX_HEAP,				/* length */
 			PROT_WRITE,				/* permissions */
-			MAP_PRIVATE,			/* private or shared? */
+			MAP_PRIVATE | MAP_NORESERVE,	/* private or shared? */
 			dev_zero,				/* fd */
 			0);						/* offset (dunno) */
+#endif
 	mem_max_addr = heap + MAX_HEAP;
-	mem_brk = heap;					/* heap is empty initially */
+	mem_brk = mem_peak_brk = heap;	/* heap is empty initially */
 }
 
 /* 
@@ -47,26 +62,61 @@ void mem_deinit(void){
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
  */
 void mem_reset_brk(){
-	mem_brk = heap;
+	mem_brk = mem_peak_brk = heap;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *		by incr bytes and returns the start address of the new area. In
- *		this model, the heap cannot be shrunk.
+ *		by incr bytes and returns the start address of the new area.
+ *		A negative incr shrinks the heap, and the whole pages given
+ *		back are returned to the system.
  */
-void *mem_sbrk(int incr) {
+void *mem_sbrk(intptr_t incr) {
+#ifdef LIBMM
+	if (heap == NULL)
+		mem_init();
+	char *old_brk = mem_brk;
+
+	// no sbrk() here: libmm.so is the only malloc of the process, and the
+	// reserved pages are made writable a chunk at a time instead.
+	if (heap == NULL || (incr > mem_max_addr - mem_brk) ||
+			(incr < heap - mem_brk)) {
+		errno = ENOMEM;
+		return (void *)-1;
+	}
+	if (incr > mem_commit - mem_brk) {
+		char *end = (char *)(((size_t)mem_brk + incr + COMMIT_CHUNK - 1) &
+				~(COMMIT_CHUNK - 1));
+		if (end > mem_max_addr)
+			end = mem_max_addr;
+		if (mprotect(mem_commit, end - mem_commit, PROT_READ | PROT_WRITE) < 0) {
+			errno = ENOMEM;
+			return (void *)-1;
+		}
+		mem_commit = end;
+	}
+#else
 	char *old_brk = mem_brk;
 
     // call sbrk() in an attempt to have similar semantics as a real allocator.
-	if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr) ||
-            sbrk(incr) == (void *) -1) {
+    // Never shrink the real break: libc's malloc owns the memory below it.
+	if ( (incr > mem_max_addr - mem_brk) || (incr < heap - mem_brk) ||
+            (incr > 0 && sbrk(incr) == (void *) -1)) {
 		errno = ENOMEM;
 		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 		return (void *)-1;
 	}
+#endif
 
 	mem_brk += incr;
+	if (mem_brk > mem_peak_brk)
+		mem_peak_brk = mem_brk;
+	if (incr < 0) {
+		size_t page = mem_pagesize();
+		char *lo = (char *)(((size_t)mem_brk + page - 1) & ~(page - 1));
+		if (lo < old_brk)
+			madvise(lo, old_brk - lo, MADV_DONTNEED);
+	}
 	return (void *)old_brk;
 }
 
@@ -91,6 +141,42 @@ size_t mem_heapsize() {
 	return (size_t)((void *)mem_brk - (void *)heap);
 }
 
+/*
+ * mem_purge - give the pages in [lo, lo + len) back to the system, which
+ *		reads them as zeros from now on; lo and len must be page aligned
+ */
+void mem_purge(void *lo, size_t len) {
+	if (len > 0)
+		madvise(lo, len, MADV_DONTNEED);
+}
+
+/*
+ * mem_resident() - returns the number of heap bytes resident in memory
+ */
+size_t mem_resident() {
+	size_t page = mem_pagesize();
+	size_t pages = (mem_heapsize() + page - 1) / page;
+	size_t resident = 0;
+	unsigned char vec[4096];
+
+	for (size_t i = 0; i < pages; i += sizeof(vec)) {
+		size_t n = pages - i < sizeof(vec) ? pages - i : sizeof(vec);
+		if (mincore(heap + i * page, n * page, vec) < 0)
+			return 0;
+		for (size_t j = 0; j < n; j++)
+			resident += vec[j] & 1;
+	}
+	return resident * page;
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest heap size in bytes since the
+ *		heap was last reset
+ */
+size_t mem_peak_heapsize() {
+	return (size_t)((void *)mem_peak_brk - (void *)heap);
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
@@ -78,6 +78,7 @@ static void *heap_start;
 static int *link_start;
 static int splay_root;
 static int hi_tag;
+static unsigned int bin_map;
 static int in_heap(const void *p);
 static int splay_rotate(int node, int lr);
 static int splay_insert(int node, void *ptr);
@@ -100,6 +101,7 @@ int mm_init(void)
     heap_start = mem_heap_hi() + 1;
     splay_root = 1;
     hi_tag = 0;
+    bin_map = 0;
     return 0;
 }
 
@@ -309,6 +311,7 @@ static void free_insert(void *ptr, int size)
             TAG_FREE_LIST(heap_start + *link);
             FREE_PREV(heap_start + *link) = ptr - heap_start;
         }
+        else bin_map |= 1U << ((size - 16) >> 3);
         FREE_CHILD(ptr, 0) = 0;
         FREE_NEXT(ptr) = *link;
         *link = ptr - heap_start;
@@ -326,8 +329,10 @@ static void free_insert(void *ptr, int size)
 static void *free_search(int size)
 {
     size = MAX(size, 16);
-    for (int i = (size >> 3) - 2; i < THRESHOLD; i++)
-        if (link_start[i] != 1)return heap_start + link_start[i];
+    int list_no = (size >> 3) - 2;
+    if (list_no < THRESHOLD && bin_map >> list_no)
+        return heap_start + link_start[__builtin_ctz(bin_map >> list_no <<
+                                                     list_no)];
     splay_root = splay_search(splay_root, size);
     if (splay_root == 1)return NULL;
     if (size > FREE_SIZE(heap_start + splay_root))return NULL;
@@ -347,6 +352,7 @@ static void free_remove(void *ptr)
     {
         link_start[(FREE_SIZE(ptr) - 16) >> 3] = next = FREE_NEXT(ptr);
         if (next != 1)FREE_CHILD(heap_start + next, 0) = 0;
+        else bin_map &= ~(1U << ((FREE_SIZE(ptr) - 16) >> 3));
     }
     else
     {
@@ -0,0 +1,452 @@
+/*
+ * mm-thread.c
+ *
+ * A thread-safe version of mm.c with per-thread arenas. Every arena has its
+ * own segregated lists, bitmap and lock, and its own chunks of the heap, so
+ * threads bound to different arenas never contend. Threads are bound to the
+ * arenas round-robin on their first call. Only growing the heap takes the
+ * global sbrk lock.
+ *
+ * Blocks use the same format as mm.c. The heap is cut into chunks whose
+ * size is a multiple of CHUNKSIZE, each owned by one arena; chunk_owner
+ * maps every CHUNKSIZE granule of the heap to its arena, so free finds the
+ * arena a block has to go back to even when it was allocated by another
+ * thread. A chunk ends with a fence, an allocated block of size 8 that
+ * keeps coalescing inside the chunk and carries the previous-block-free bit
+ * of the last block (the role hi_tag plays in mm.c). When an arena grows
+ * and its last chunk is at the top of the heap, the new chunk is merged
+ * into it through the old fence.
+ *
+ */
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mm.h"
+#include "memlib.h"
+#ifdef DRIVER
+#define malloc mm_malloc
+#define free mm_free
+#define realloc mm_realloc
+#define calloc mm_calloc
+#endif
+#define ALIGNMENT 8
+#define ALIGN(p) (((size_t)(p) + (ALIGNMENT - 1)) & ~0x7)
+#define MAX(x, y) ((x) > (y)? (x) : (y))
+#define TAG_ALLOC(ptr, size) (((int *)(ptr))[0] = (size) ^ 0x4)
+#define TAG_PREV_ALLOC(ptr) (((int *)(ptr))[0] &= ~1)
+#define TAG_PREV_FREE(ptr) (((int *)(ptr))[0] |= 1)
+#define TAG_FREE_8(ptr) (((long *)(ptr))[0] = 8LL << 32 | 8)
+#define TAG_FREE(ptr, size) (((int *)(ptr))[0] = \
+		((int *)((ptr) + (size)))[-1] = (size))
+#define ALLOC_TAG(ptr) (((int *)(ptr))[0] & 0x4)
+#define ALLOC_SIZE(ptr) (((int *)(ptr))[0] & ~0x7)
+#define FREE_SIZE(ptr) (((int *)(ptr))[0] & ~0x7)
+#define FREE_PREV(ptr) ((int *)(ptr))[1]
+#define FREE_NEXT(ptr) ((int *)(ptr))[2]
+#define PREV_FREE_TAG(ptr) (((int *)(ptr))[0] & 0x1)
+#define PREV_FREE_SIZE(ptr) (((int *)(ptr))[-1] & ~0x7)
+#define GET_NO(size) (27 - __builtin_clz(size))
+#define LIST_LEN 27
+#define NARENAS 8
+#define CHUNK_SHIFT 16
+#define CHUNKSIZE (1 << CHUNK_SHIFT)
+#define OWNER(ptr) chunk_owner[((ptr) - heap_start) >> CHUNK_SHIFT]
+
+typedef struct {
+    pthread_mutex_t lock;
+    int link[LIST_LEN];
+    unsigned int bin_map;
+    void *top;          /* end of the last chunk of this arena */
+} arena_t;
+
+/* several threads may call this package at once */
+const int mm_thread_safe = 1;
+
+static void *heap_start = 0;
+static arena_t arenas[NARENAS];
+static unsigned char chunk_owner[1U << (31 - CHUNK_SHIFT)];
+static pthread_mutex_t sbrk_lock = PTHREAD_MUTEX_INITIALIZER;
+static int next_arena;
+static __thread int arena_no = -1;
+static arena_t *get_arena(void);
+static void free_insert(arena_t *a, void *ptr, int size);
+static void *free_search(arena_t *a, int size);
+static void free_remove(arena_t *a, void *ptr);
+static int extend_arena(arena_t *a, int size);
+static void coalesce(arena_t *a, void *ptr, int size);
+
+
+/*
+ * mm_init - Initialize the heap and all the arenas. Return -1 on error,
+ *     0 on success. Must not race with any other call.
+ */
+int mm_init(void)
+{
+    if (mem_sbrk(4) == (void *)-1)return -1;
+    heap_start = mem_heap_hi() + 1;
+    for (int i = 0; i < NARENAS; i++)
+    {
+        pthread_mutex_init(&arenas[i].lock, NULL);
+        for (int j = 0; j < LIST_LEN; j++)arenas[i].link[j] = 1;
+        arenas[i].bin_map = 0;
+        arenas[i].top = NULL;
+    }
+    next_arena = 0;
+    return 0;
+}
+
+
+/*
+ * malloc - Return pointer to the allocated block on success, -1 on error.
+ *     If size is 0, return NULL. The block comes from the arena of the
+ *     calling thread.
+ */
+void *malloc(size_t size)
+{
+    if (size == 0)return NULL;
+    size = ALIGN(size + 4);
+    arena_t *a = get_arena();
+    pthread_mutex_lock(&a->lock);
+    void *ptr = free_search(a, (int)size);
+    if (!ptr)
+    {
+        if (extend_arena(a, (int)size) == -1)
+        {
+            pthread_mutex_unlock(&a->lock);
+            return (void *)-1;
+        }
+        ptr = free_search(a, (int)size);
+    }
+    free_remove(a, ptr);
+    int remain = FREE_SIZE(ptr) - size;
+    free_insert(a, ptr + size, remain);
+    TAG_ALLOC(ptr, size);
+    pthread_mutex_unlock(&a->lock);
+    return ptr + 4;
+}
+
+
+/*
+ * free - Free the block pointed by ptr into the arena owning it.
+ */
+void free(void *ptr)
+{
+    if (!ptr)return;
+    ptr -= 4;
+    arena_t *a = arenas + OWNER(ptr);
+    pthread_mutex_lock(&a->lock);
+    coalesce(a, ptr, ALLOC_SIZE(ptr));
+    pthread_mutex_unlock(&a->lock);
+}
+
+
+/*
+ * realloc - Reallocate the block pointer by oldptr with a new block with
+ *     enough size. The block is resized in place inside the arena owning
+ *     it if possible, otherwise moved to the arena of the calling thread.
+ *     Return pointer to the newly allocated block on success, -1 on error.
+ */
+void *realloc(void *oldptr, size_t size)
+{
+    if (oldptr == NULL)return malloc(size);
+    if (size == 0) { free(oldptr); return 0; }
+    oldptr -= 4;
+    arena_t *a = arenas + OWNER(oldptr);
+    pthread_mutex_lock(&a->lock);
+    int old_size = ALLOC_SIZE(oldptr);
+    int prev_free = PREV_FREE_TAG(oldptr);
+    size = ALIGN(size + 4);
+    void *next = oldptr + old_size;
+    if ((int)size <= old_size)
+    {
+        if ((int)size < old_size)
+        {
+            TAG_ALLOC(oldptr, size);
+            if (prev_free)TAG_PREV_FREE(oldptr);
+            int next_size = old_size - size;
+            if (!ALLOC_TAG(next))
+            {
+                if (FREE_SIZE(next) == 8)next_size += 8;
+                else { free_remove(a, next); next_size += FREE_SIZE(next); }
+            }
+            free_insert(a, oldptr + size, next_size);
+        }
+        pthread_mutex_unlock(&a->lock);
+        return oldptr + 4;
+    }
+    else if (!ALLOC_TAG(next) && FREE_SIZE(next) + old_size >= (int)size)
+    {
+        if (FREE_SIZE(next) != 8)free_remove(a, next);
+        old_size += FREE_SIZE(next);
+        TAG_ALLOC(oldptr, size);
+        if (prev_free)TAG_PREV_FREE(oldptr);
+        free_insert(a, oldptr + size, old_size - size);
+        pthread_mutex_unlock(&a->lock);
+        return oldptr + 4;
+    }
+    pthread_mutex_unlock(&a->lock);
+    void *new_ptr = malloc(size - 4);
+    if (new_ptr == (void *)-1)return (void *)-1;
+    memcpy(new_ptr, oldptr + 4, old_size - 4);
+    free(oldptr + 4);
+    return new_ptr;
+}
+
+
+/*
+ * calloc - Malloc a block of enough size initialized with 0. Return pointer
+ *     to the allocated block on success, -1 on error.
+ */
+void *calloc(size_t nmemb, size_t size)
+{
+    size_t bytes = nmemb * size;
+    void *new_ptr;
+    new_ptr = malloc(bytes);
+    if (new_ptr == (void *)-1)return (void *)-1;
+    memset(new_ptr, 0, bytes);
+    return new_ptr;
+}
+
+
+/*
+ * get_arena - Return the arena of the calling thread, binding the thread to
+ *     the next arena round-robin on its first call.
+ */
+static arena_t *get_arena(void)
+{
+    if (arena_no < 0)
+        arena_no = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED)
+                   % NARENAS;
+    return arenas + arena_no;
+}
+
+
+/*
+ * free_insert - Insert a free block to the segregated lists of arena a. If
+ *     size is 0, mark the previous block of ptr is allocated; if size is 8,
+ *     store the header and footer of the free block and mark the previous
+ *     block of ptr+8 is free.
+ */
+static void free_insert(arena_t *a, void *ptr, int size)
+{
+    if (!size) { TAG_PREV_ALLOC(ptr); return; }
+    if (size == 8) { TAG_FREE_8(ptr); TAG_PREV_FREE(ptr + 8); return; }
+    TAG_FREE(ptr, size);
+    int list_no = GET_NO(size);
+    int *link = a->link + list_no;
+    if (*link != 1)FREE_PREV(heap_start + *link) = ptr - heap_start;
+    else a->bin_map |= 1U << list_no;
+    FREE_NEXT(ptr) = *link;
+    FREE_PREV(ptr) = 1;
+    *link = ptr - heap_start;
+    TAG_PREV_FREE(ptr + size);
+}
+
+
+/*
+ * free_search - Search a free block of enough size in the segregated lists
+ *     of arena a. The strategy is first fit. Return NULL if such block is
+ *     not found.
+ */
+static void *free_search(arena_t *a, int size)
+{
+    size = MAX(size, 16);
+    int list_no = GET_NO(size);
+    unsigned int map = a->bin_map >> list_no << list_no;
+    void *ptr;
+    if (!map)return NULL;
+    if (map & 1U << list_no)
+    {
+        ptr = heap_start + a->link[list_no];
+        if (FREE_SIZE(ptr) >= size)return ptr;
+        while (FREE_NEXT(ptr) != 1)
+        {
+            ptr = heap_start + FREE_NEXT(ptr);
+            if (FREE_SIZE(ptr) >= size)return ptr;
+        }
+        map &= map - 1;
+        if (!map)return NULL;
+    }
+    return heap_start + a->link[__builtin_ctz(map)];
+}
+
+
+/*
+ * free_remove - Remove a free block from the segregated lists of arena a.
+ *     ptr must points to a free block in these lists.
+ */
+static void free_remove(arena_t *a, void *ptr)
+{
+    int prev = FREE_PREV(ptr);
+    int next = FREE_NEXT(ptr);
+    if (prev == 1)
+    {
+        int list_no = GET_NO(FREE_SIZE(ptr));
+        a->link[list_no] = next;
+        if (next != 1)FREE_PREV(heap_start + next) = 1;
+        else a->bin_map &= ~(1U << list_no);
+    }
+    else
+    {
+        FREE_NEXT(heap_start + prev) = next;
+        if (next != 1)FREE_PREV(heap_start + next) = prev;
+    }
+}
+
+
+/*
+ * extend_arena - Give arena a a new chunk, so that it holds a free block of
+ *     at least size bytes. Return 0 on success, -1 on error.
+ */
+static int extend_arena(arena_t *a, int size)
+{
+    pthread_mutex_lock(&sbrk_lock);
+    void *ptr = mem_heap_hi() + 1;
+    int merge = a->top == ptr;
+    int need = size + 8;
+    if (merge)
+    {
+        ptr -= 8;
+        if (PREV_FREE_TAG(ptr))need -= PREV_FREE_SIZE(ptr);
+    }
+    int chunk = (MAX(need, 8) + CHUNKSIZE - 1) & ~(CHUNKSIZE - 1);
+    if (ptr + chunk - heap_start + 8 > 1L << 31 ||
+        mem_sbrk(chunk) == (void *)-1)
+    {
+        pthread_mutex_unlock(&sbrk_lock);
+        return -1;
+    }
+    a->top = mem_heap_hi() + 1;
+    pthread_mutex_unlock(&sbrk_lock);
+    memset(&OWNER(a->top - chunk), a - arenas, chunk >> CHUNK_SHIFT);
+    if (!merge)TAG_ALLOC(ptr, 8);
+    TAG_ALLOC(a->top - 8, 8);
+    coalesce(a, ptr, a->top - 8 - ptr);
+    return 0;
+}
+
+
+/*
+ * coalesce - Coalesce the free block pointed by ptr with its previous and
+ *     next free block, and insert the new free block into arena a.
+ */
+static void coalesce(arena_t *a, void *ptr, int size)
+{
+    if (PREV_FREE_TAG(ptr))
+    {
+        int prev_size = PREV_FREE_SIZE(ptr);
+        size += prev_size;
+        ptr -= prev_size;
+        if (prev_size != 8)free_remove(a, ptr);
+    }
+    void *next = ptr + size;
+    if (!ALLOC_TAG(next))
+    {
+        if (FREE_SIZE(next) == 8)size += 8;
+        else { free_remove(a, next); size += FREE_SIZE(next); }
+    }
+    free_insert(a, ptr, size);
+}
+
+
+/*
+ * mm_checkheap - Check whether the heap and the lists of every arena are
+ *     consistent. Run silently if no error is spotted. Exit if any error
+ *     is encountered. Must not race with any other call.
+ */
+void mm_checkheap(int lineno)
+{
+    /* Checking the heap */
+
+    // 1. Check each block's alignment, tags, footer, coalescing and owner.
+    void *ptr = heap_start;
+    int prev_state = 0, iterate = 0, traverse = 0;
+    while (ptr <= mem_heap_hi())
+    {
+        int size = ALLOC_TAG(ptr) ? ALLOC_SIZE(ptr) : FREE_SIZE(ptr);
+        if ((long)(ptr + 4) % 8 || size < 8 || size % 8)
+        {
+            fprintf(stderr, "%d: bad block at %p\n", lineno, ptr);
+            exit(1);
+        }
+        if (OWNER(ptr) != OWNER(ptr + size - 1))
+        {
+            fprintf(stderr, "%d: block crosses arenas\n", lineno);
+            exit(1);
+        }
+        if (ptr != heap_start && !prev_state != !PREV_FREE_TAG(ptr))
+        {
+            fprintf(stderr, "%d: inconsistent free bit\n", lineno);
+            exit(1);
+        }
+        if (!ALLOC_TAG(ptr))
+        {
+            if (prev_state)
+            {
+                fprintf(stderr, "%d: consecutive free blocks\n", lineno);
+                exit(1);
+            }
+            if (FREE_SIZE(ptr) != FREE_SIZE(ptr + size - 4))
+            {
+                fprintf(stderr, "%d: header and footer not match\n", lineno);
+                exit(1);
+            }
+            if (size > 8)iterate++;
+        }
+        prev_state = !ALLOC_TAG(ptr);
+        ptr += size;
+    }
+
+    // 2. Check heap boundaries.
+    if (ptr != mem_heap_hi() + 1)
+    {
+        fprintf(stderr, "%d: ptr did not reach heap boundary\n", lineno);
+        exit(1);
+    }
+
+    /* Checking the free lists of every arena */
+
+    // 1. Bitmaps match the lists, pointers are consistent and every block
+    //    is in the right list of the arena owning it.
+    for (arena_t *a = arenas; a < arenas + NARENAS; a++)
+        for (int i = 0; i < LIST_LEN; i++)
+        {
+            if (!(a->bin_map >> i & 1) != (a->link[i] == 1))
+            {
+                fprintf(stderr, "%d: bitmap and list not match\n", lineno);
+                exit(1);
+            }
+            int prev = 1;
+            for (int link = a->link[i]; link != 1; link = FREE_NEXT(ptr))
+            {
+                ptr = heap_start + link;
+                if (ptr < mem_heap_lo() || ptr > mem_heap_hi())
+                {
+                    fprintf(stderr, "%d: pointer out of heap\n", lineno);
+                    exit(1);
+                }
+                if (FREE_PREV(ptr) != prev)
+                {
+                    fprintf(stderr, "%d: inconsistent pointers\n", lineno);
+                    exit(1);
+                }
+                if (GET_NO(FREE_SIZE(ptr)) != i || OWNER(ptr) != a - arenas)
+                {
+                    fprintf(stderr, "%d: free block in wrong list\n", lineno);
+                    exit(1);
+                }
+                prev = link;
+                traverse++;
+            }
+        }
+
+    // 2. Count free blocks by iterating and traversing and see if they match.
+    if (iterate != traverse)
+    {
+        fprintf(stderr, "%d: free block count not match\n", lineno);
+        exit(1);
+    }
+}
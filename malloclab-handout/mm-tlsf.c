@@ -0,0 +1,448 @@
+/*
+ * mm-tlsf.c
+ *
+ * A two-level segregated fit (TLSF) allocator. malloc and free run in
+ * constant time: no free list is ever walked.
+ *
+ * Blocks use the same format as mm.c: a 4-byte header whose last three
+ * bits are "x 0 x" (allocated bit, previous-block-free bit), free blocks
+ * additionally hold prev/next links as offsets from heap_start (1 is the
+ * null link) and a footer, and free blocks of size 8 only consist of a
+ * header and a footer and are not kept in any list.
+ *
+ * Free blocks are indexed by two levels. The first level splits sizes into
+ * powers of two, the second level splits each power of two linearly into
+ * SL_LEN lists:
+ *     fl = 0:  [0, 128) in steps of 8,
+ *     fl >= 1: [2^(fl+6), 2^(fl+7)) in steps of 2^(fl+6) / SL_LEN.
+ * fl_map has bit fl set iff some list of the first level fl is non-empty,
+ * and the sl_map of fl has bit sl set iff list (fl, sl) is non-empty.
+ *
+ * A request is rounded up to the next list boundary before the lookup, so
+ * the head of any non-empty list found through the bitmaps is large enough
+ * (good fit). If there is none, the head of the list the request falls in
+ * is tried once before the heap is extended.
+ *
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mm.h"
+#include "memlib.h"
+#ifdef DRIVER
+#define malloc mm_malloc
+#define free mm_free
+#define realloc mm_realloc
+#define calloc mm_calloc
+#endif
+#define ALIGNMENT 8
+#define ALIGN(p) (((size_t)(p) + (ALIGNMENT - 1)) & ~0x7)
+#define ALIGN_ODD(p) (((size_t)(p) & ~0x1) + 1)
+#define MAX(x, y) ((x) > (y)? (x) : (y))
+#define TAG_ALLOC(ptr, size) (((int *)(ptr))[0] = (size) ^ 0x4)
+#define TAG_PREV_ALLOC_PTR(ptr) (((int *)(ptr))[0] &= ~1)
+#define TAG_PREV_FREE_PTR(ptr) (((int *)(ptr))[0] |= 1)
+#define TAG_PREV_ALLOC(ptr) \
+	TAG_PREV_ALLOC_PTR((ptr) == mem_heap_hi() + 1 ? &hi_tag : (ptr))
+#define TAG_PREV_FREE(ptr) \
+	TAG_PREV_FREE_PTR((ptr) == mem_heap_hi() + 1 ? &hi_tag : (ptr))
+#define TAG_FREE_8(ptr) (((long *)(ptr))[0] = 8LL << 32 | 8)
+#define TAG_FREE(ptr, size) (((int *)(ptr))[0] = \
+		((int *)((ptr) + (size)))[-1] = (size))
+#define ALLOC_TAG(ptr) (((int *)(ptr))[0] & 0x4)
+#define ALLOC_SIZE(ptr) (((int *)(ptr))[0] & ~0x7)
+#define FREE_SIZE(ptr) (((int *)(ptr))[0] & ~0x7)
+#define FREE_PREV(ptr) ((int *)(ptr))[1]
+#define FREE_NEXT(ptr) ((int *)(ptr))[2]
+#define PREV_FREE_TAG(ptr) (((int *)(ptr))[0] & 0x1)
+#define PREV_FREE_SIZE(ptr) (((int *)(ptr))[-1] & ~0x7)
+#define SL_LOG2 4
+#define SL_LEN (1 << SL_LOG2)
+#define FL_SHIFT (SL_LOG2 + 3)
+#define FL_LEN (32 - FL_SHIFT)
+#define SMALL_SIZE (1 << FL_SHIFT)
+#define LIST(fl, sl) link_start[(fl) * SL_LEN + (sl)]
+#define SL_MAP(fl) link_start[FL_LEN * SL_LEN + (fl)]
+#define BLOCKSIZE 4096
+static void *heap_start = 0;
+static int *link_start;
+static int hi_tag;
+static unsigned int fl_map;
+static void mapping(int size, int *fl, int *sl);
+static void free_insert(void *ptr, int size);
+static void *free_search(int size);
+static void free_remove(void *ptr);
+static void *extend_heap(int size);
+static void coalesce(void *ptr, int size);
+
+
+/*
+ * mm_init - Initialize the heap. Return -1 on error, 0 on success.
+ */
+int mm_init(void)
+{
+    link_start = mem_sbrk(ALIGN_ODD(FL_LEN * SL_LEN + FL_LEN) * 4);
+    if (link_start == (void *)-1)return -1;
+    for (int i = 0; i < FL_LEN * SL_LEN; i++)link_start[i] = 1;
+    for (int i = 0; i < FL_LEN; i++)SL_MAP(i) = 0;
+    heap_start = mem_heap_hi() + 1;
+    if (heap_start == NULL)return -1;
+    hi_tag = 0; fl_map = 0;
+    return 0;
+}
+
+
+/*
+ * malloc - Return pointer to the allocated block on success, -1 on error.
+ *     If size is 0, return NULL.
+ */
+void *malloc(size_t size)
+{
+    if (size == 0)return NULL;
+    size = ALIGN(size + 4);
+    void *ptr = free_search((int)size);
+    int remain;
+    if (ptr)
+    {
+        free_remove(ptr);
+        remain = FREE_SIZE(ptr) - size;
+        free_insert(ptr + size, remain);
+        TAG_ALLOC(ptr, size);
+    }
+    else
+    {
+        ptr = mem_heap_hi() + 1;
+        if (ptr == NULL)return (void *)-1;
+        if (hi_tag)
+        {
+            remain = PREV_FREE_SIZE(ptr);
+            ptr -= remain;
+            if (remain != 8)free_remove(ptr);
+            hi_tag = 0;
+            if (size - remain)
+                if (extend_heap(size - remain) == (void *)-1)
+                    return (void *)-1;
+        }
+        else if (extend_heap(size) == (void *)-1)return (void *)-1;
+        TAG_ALLOC(ptr, size);
+    }
+    return ptr + 4;
+}
+
+
+/*
+ * free - Free the block pointed by ptr.
+ */
+void free(void *ptr)
+{
+    if (!ptr)return;
+    if (heap_start == 0)mm_init();
+    ptr -= 4;
+    int size = ALLOC_SIZE(ptr);
+    coalesce(ptr, size);
+}
+
+
+/*
+ * realloc - Reallocate the block pointer by oldptr with a new block with
+ *     enough size. Return pointer to the newly allocated block on success,
+ *     -1 on error.
+ */
+void *realloc(void *oldptr, size_t size)
+{
+    if (oldptr == NULL)return malloc(size);
+    if (size == 0) { free(oldptr); return 0; }
+    oldptr -= 4;
+    int old_size = ALLOC_SIZE(oldptr);
+    int prev_free = PREV_FREE_TAG(oldptr);
+    size = ALIGN(size + 4);
+    if ((int)size == old_size)return oldptr + 4;
+    else if ((int)size < old_size)
+    {
+        TAG_ALLOC(oldptr, size);
+        if (prev_free)TAG_PREV_FREE(oldptr);
+        void *next = oldptr + old_size;
+        int next_size = old_size - size;
+        if (next <= mem_heap_hi() && !ALLOC_TAG(next))
+        {
+            if (FREE_SIZE(next) == 8)next_size += 8;
+            else { free_remove(next); next_size += FREE_SIZE(next); }
+        }
+        free_insert(oldptr + size, next_size);
+        return oldptr + 4;
+    }
+    else if (oldptr + old_size == mem_heap_hi() + 1)
+    {
+        if (extend_heap(size - old_size) == (void *)-1)return (void *)-1;
+        TAG_ALLOC(oldptr, size);
+        if (prev_free)TAG_PREV_FREE(oldptr);
+        return oldptr + 4;
+    }
+    else if (!ALLOC_TAG(oldptr + old_size) &&
+             FREE_SIZE(oldptr + old_size) + old_size >= (int)size)
+    {
+        if (FREE_SIZE(oldptr + old_size) != 8)free_remove(oldptr + old_size);
+        old_size += FREE_SIZE(oldptr + old_size);
+        TAG_ALLOC(oldptr, size);
+        if (prev_free)TAG_PREV_FREE(oldptr);
+        free_insert(oldptr + size, old_size - size);
+        return oldptr + 4;
+    }
+    else
+    {
+        void *new_ptr = malloc(size - 4);
+        if (new_ptr == (void *)-1)return (void *)-1;
+        memcpy(new_ptr, oldptr + 4, old_size - 4);
+        free(oldptr + 4);
+        return new_ptr;
+    }
+}
+
+
+/*
+ * calloc - Malloc a block of enough size initialized with 0. Return pointer
+ *     to the allocated block on success, -1 on error.
+ */
+void *calloc(size_t nmemb, size_t size)
+{
+    size_t bytes = nmemb * size;
+    void *new_ptr;
+    new_ptr = malloc(bytes);
+    if (new_ptr == (void *)-1)return (void *)-1;
+    memset(new_ptr, 0, bytes);
+    return new_ptr;
+}
+
+
+/*
+ * mapping - Compute the first and second level index of the list that
+ *     blocks of size belong to.
+ */
+static void mapping(int size, int *fl, int *sl)
+{
+    if (size < SMALL_SIZE) { *fl = 0; *sl = size >> 3; return; }
+    int msb = 31 - __builtin_clz(size);
+    *fl = msb - FL_SHIFT + 1;
+    *sl = (size >> (msb - SL_LOG2)) & (SL_LEN - 1);
+}
+
+
+/*
+ * free_insert - Insert a free block to the head of its list. If size is 0,
+ *     mark the previous block of ptr is allocated; if size is 8, store the
+ *     header and footer of the free block and mark the previous block of
+ *     ptr+8 is free.
+ */
+static void free_insert(void *ptr, int size)
+{
+    if (!size) { TAG_PREV_ALLOC(ptr); return; }
+    if (size == 8) { TAG_FREE_8(ptr); TAG_PREV_FREE(ptr + 8); return; }
+    TAG_FREE(ptr, size);
+    int fl, sl;
+    mapping(size, &fl, &sl);
+    int *link = &LIST(fl, sl);
+    if (*link != 1)FREE_PREV(heap_start + *link) = ptr - heap_start;
+    else { SL_MAP(fl) |= 1 << sl; fl_map |= 1U << fl; }
+    FREE_NEXT(ptr) = *link;
+    FREE_PREV(ptr) = 1;
+    *link = ptr - heap_start;
+    TAG_PREV_FREE(ptr + size);
+}
+
+
+/*
+ * free_search - Find a free block of enough size in constant time. Round
+ *     size up to the next list boundary and take the head of the first
+ *     non-empty list from there on; fall back to the head of the list size
+ *     belongs to. Return NULL if such block is not found.
+ */
+static void *free_search(int size)
+{
+    size = MAX(size, 16);
+    int fl, sl;
+    void *ptr;
+    if (size < SMALL_SIZE)mapping(size, &fl, &sl);
+    else mapping(size + (1 << (31 - __builtin_clz(size) - SL_LOG2)) - 1,
+                 &fl, &sl);
+    unsigned int map = SL_MAP(fl) & (~0U << sl);
+    if (!map && fl + 1 < FL_LEN && (fl_map & (~0U << (fl + 1))))
+    {
+        fl = __builtin_ctz(fl_map & (~0U << (fl + 1)));
+        map = SL_MAP(fl);
+    }
+    if (map)return heap_start + LIST(fl, __builtin_ctz(map));
+    mapping(size, &fl, &sl);
+    if (LIST(fl, sl) == 1)return NULL;
+    ptr = heap_start + LIST(fl, sl);
+    return FREE_SIZE(ptr) >= size ? ptr : NULL;
+}
+
+
+/*
+ * free_remove - Remove a free block from its list. ptr must points to a
+ *     free block in the lists.
+ */
+static void free_remove(void *ptr)
+{
+    int prev = FREE_PREV(ptr);
+    int next = FREE_NEXT(ptr);
+    if (prev == 1)
+    {
+        int fl, sl;
+        mapping(FREE_SIZE(ptr), &fl, &sl);
+        LIST(fl, sl) = next;
+        if (next != 1)FREE_PREV(heap_start + next) = 1;
+        else if (!(SL_MAP(fl) &= ~(1 << sl)))fl_map &= ~(1U << fl);
+    }
+    else
+    {
+        FREE_NEXT(heap_start + prev) = next;
+        if (next != 1)FREE_PREV(heap_start + next) = prev;
+    }
+}
+
+
+/*
+ * extend_heap - Extend the heap by at least size bytes. Return 0 on success,
+ *     -1 on error.
+ */
+static void *extend_heap(int size)
+{
+    if (size < BLOCKSIZE)
+    {
+        int remain = BLOCKSIZE - size;
+        if (mem_sbrk(BLOCKSIZE) == (void *)-1)return (void *)-1;
+        free_insert(mem_heap_hi() + 1 - remain, remain);
+    }
+    else if (mem_sbrk(size) == (void *)-1)return (void *)-1;
+    return 0;
+}
+
+
+/*
+ * coalesce - Coalesce the free block pointed by ptr with its previous and
+ *     next free block, and insert the new free block.
+ */
+static void coalesce(void *ptr, int size)
+{
+    if (PREV_FREE_TAG(ptr))
+    {
+        int prev_size = PREV_FREE_SIZE(ptr);
+        size += prev_size;
+        ptr -= prev_size;
+        if (prev_size != 8)free_remove(ptr);
+    }
+    void *next = ptr + size;
+    if (next <= mem_heap_hi() && !ALLOC_TAG(next))
+    {
+        if (FREE_SIZE(next) == 8)size += 8;
+        else { free_remove(next); size += FREE_SIZE(next); }
+    }
+    free_insert(ptr, size);
+}
+
+
+/*
+ * mm_checkheap - Check whether the heap, the lists and the bitmaps are
+ *     consistent. Run silently if no error is spotted. Exit if any error
+ *     is encountered.
+ */
+void mm_checkheap(int lineno)
+{
+    /* Checking the heap */
+
+    // 1. Check each block's alignment, tags, footer and coalescing.
+    void *ptr = heap_start;
+    int prev_state = 0, iterate = 0, traverse = 0;
+    while (ptr <= mem_heap_hi())
+    {
+        int size = ALLOC_TAG(ptr) ? ALLOC_SIZE(ptr) : FREE_SIZE(ptr);
+        if ((long)(ptr + 4) % 8 || size < 8 || size % 8)
+        {
+            fprintf(stderr, "%d: bad block at %p\n", lineno, ptr);
+            exit(1);
+        }
+        if (ptr != heap_start && !prev_state != !PREV_FREE_TAG(ptr))
+        {
+            fprintf(stderr, "%d: inconsistent free bit\n", lineno);
+            exit(1);
+        }
+        if (!ALLOC_TAG(ptr))
+        {
+            if (prev_state)
+            {
+                fprintf(stderr, "%d: consecutive free blocks\n", lineno);
+                exit(1);
+            }
+            if (FREE_SIZE(ptr) != FREE_SIZE(ptr + size - 4))
+            {
+                fprintf(stderr, "%d: header and footer not match\n", lineno);
+                exit(1);
+            }
+            if (size > 8)iterate++;
+        }
+        prev_state = !ALLOC_TAG(ptr);
+        ptr += size;
+    }
+
+    // 2. Check heap boundaries.
+    if (ptr != mem_heap_hi() + 1)
+    {
+        fprintf(stderr, "%d: ptr did not reach heap boundary\n", lineno);
+        exit(1);
+    }
+
+    /* Checking the lists */
+
+    // 1. Bitmaps match the lists, pointers are consistent and every block
+    //    is in the right list.
+    int fl, sl;
+    for (int i = 0; i < FL_LEN; i++)
+    {
+        if (!(fl_map >> i & 1) != !SL_MAP(i))
+        {
+            fprintf(stderr, "%d: first level bitmap not match\n", lineno);
+            exit(1);
+        }
+        for (int j = 0; j < SL_LEN; j++)
+        {
+            if (!(SL_MAP(i) >> j & 1) != (LIST(i, j) == 1))
+            {
+                fprintf(stderr, "%d: second level bitmap not match\n", lineno);
+                exit(1);
+            }
+            int prev = 1;
+            for (int link = LIST(i, j); link != 1; link = FREE_NEXT(ptr))
+            {
+                ptr = heap_start + link;
+                if (ptr < mem_heap_lo() || ptr > mem_heap_hi())
+                {
+                    fprintf(stderr, "%d: pointer out of heap\n", lineno);
+                    exit(1);
+                }
+                if (FREE_PREV(ptr) != prev)
+                {
+                    fprintf(stderr, "%d: inconsistent pointers\n", lineno);
+                    exit(1);
+                }
+                mapping(FREE_SIZE(ptr), &fl, &sl);
+                if (fl != i || sl != j)
+                {
+                    fprintf(stderr, "%d: free block in wrong list\n", lineno);
+                    exit(1);
+                }
+                prev = link;
+                traverse++;
+            }
+        }
+    }
+
+    // 2. Count free blocks by iterating and traversing and see if they match.
+    if (iterate != traverse)
+    {
+        fprintf(stderr, "%d: free block count not match\n", lineno);
+        exit(1);
+    }
+}
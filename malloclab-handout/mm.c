@@ -6,7 +6,21 @@
  *
  * I use segregated lists to maintain the free blocks. The strategy is first
  * fit. The size range of the segregated lists are as follows:
- * [2^4, 2^5), [2^5, 2^6), ..., [2^25, 2^26), [2^26, +infinity).
+ * [2^4, 2^5), [2^5, 2^6), ..., [2^33, 2^34), [2^34, 2^35).
+ * A bitmap records which lists are non-empty, so the first non-empty list
+ * that can hold a request is found by a single count-trailing-zeros.
+ *
+ * The placement policy is chosen when compiling, with no dispatch at run
+ * time. -DBEST_FIT=K takes the smallest of the first K blocks that fit
+ * instead of the first. Freed blocks are kept in address order by default
+ * (ADDR_ORDER), so that first fit takes the lowest block, pushed at the
+ * head of their list with -DLIFO, or appended at its tail with -DFIFO.
+ *
+ * A block of SPLIT_SIZE bytes up to a page is carved from the high end of
+ * the free block it is taken from, and a smaller one from the low end, so
+ * small and medium blocks, whose lifetimes tend to differ, gather in runs
+ * of their own. A run freed then coalesces into one block that larger
+ * requests can reuse, instead of holes the small blocks left between them.
  *
  * Allocated blocks consists of a header of 4 bytes and its storage:
  * -------------------------------------------------------------------------
@@ -16,7 +30,8 @@
  * -------------------------------------------------------------------------
  * 
  * Free blocks consists of a header and a footer, a previous pointer, a next
- * pointer and its storage:
+ * pointer and its storage. The pointers are 32-bit offsets from heap_start
+ * in units of 8 bytes, which reach a heap of 32 GB:
  * -------------------------------------------------------------------------
  * |                          size                          |    x 0 x     |
  * -------------------------------------------------------------------------
@@ -44,53 +59,269 @@
  * 100: This block is allocated and its previous block is allocated.
  * 101: This block is allocated and its previous block is free.
  *
+ * Blocks of at least 4 GB do not fit this header and set the middle bit
+ * instead. Their header keeps the high bits of size, and the low 32 bits
+ * are stored separately. An allocated huge block repeats its header before
+ * the payload, so its payload starts 12 bytes after the block:
+ * -------------------------------------------------------------------------
+ * |                       size >> 32                       |    x 1 x     |
+ * -------------------------------------------------------------------------
+ * |                           size & 0xffffffff                           |
+ * -------------------------------------------------------------------------
+ * |                       size >> 32                       |    x 1 x     |
+ * -------------------------------------------------------------------------
+ * |                                                                       |
+ * -------------------------------------------------------------------------
+ * A free huge block stores the low bits after its next pointer, and again
+ * before its footer.
+ *
+ * When compiled with -DTCACHE, freed blocks of at most TC_MAX_SIZE bytes
+ * are first kept in a per-thread cache with one LIFO list per exact block
+ * size. They stay allocated there, linked through the offset stored in
+ * their first payload word, and a malloc of the same size pops them without
+ * touching the segregated lists. A list holding more than TC_LIMIT blocks
+ * flushes its TC_FLUSH coldest blocks, those at its tail, to the segregated
+ * lists. So that cached blocks do not pin holes, the whole cache is flushed
+ * when a request finds no fit and when a block of at least TC_LARGE bytes
+ * is freed. When the fit is the free block at the top of the heap, or one
+ * that would leave TC_LARGE bytes or more behind, only the cached blocks
+ * that can make a better fit are flushed: those large enough, and those
+ * next to a free block. The driver calls mm.c from one thread only, as the
+ * heap has no lock there; in libmm.so the lock serializes the threads, and
+ * a miss flushes only the cache of the thread that missed.
+ *
+ * When compiled with -DFASTBIN, freed blocks of at most FB_MAX_SIZE bytes
+ * are kept in fast bins instead of being coalesced at once: one LIFO list
+ * per exact block size, linked like the cache of -DTCACHE, whose blocks
+ * stay allocated so that no header or footer is written. A malloc of the
+ * same size pops them back. The blocks of all the fast bins are coalesced
+ * when they number more than FB_LIMIT, when a block of at least FB_LARGE
+ * bytes is requested or freed, and when a request finds no free block of
+ * the segregated lists that fits, or only one that would leave FB_LARGE
+ * bytes or more behind, so that small blocks do not pin holes.
+ *
+ * When compiled with -DSLAB, requests of at most SLAB_MAX bytes are served
+ * from runs instead: a run is a one-page allocated block whose payload
+ * starts on a page boundary, so that consecutive runs tile the heap. The
+ * payload is cut into slots of one size class (8, 16, 24, 32, 48 or 64
+ * bytes) with no per-slot header, after the run descriptor:
+ * -------------------------------------------------------------------------
+ * |          next          |          prev          | class | nfree | slots |
+ * -------------------------------------------------------------------------
+ * |                    bitmap of used slots (512 bits)                    |
+ * -------------------------------------------------------------------------
+ * Runs with free slots are kept in one doubly linked list per class. A
+ * class gets its first run only once SLAB_START blocks of its size are
+ * live in the segregated lists, as slab_live counts by block size with
+ * SLAB_BORN and SLAB_DEAD, so that a few small blocks do not each pin a
+ * page.
+ * page_map, itself an ordinary block, holds the class of each heap page
+ * (0 for pages that are not runs), so free can tell slots from blocks.
+ *
+ * When compiled with -DPURGE, mm_purge gives the whole pages inside free
+ * blocks of at least PURGE_MIN bytes back to the system, leaving headers,
+ * links and footers resident. Such a free block has one more word after
+ * its links that tells whether it is already purged. The bytes still dirty
+ * decay with time constant PURGE_DECAY, largest blocks first, and a
+ * background thread started by mm_purge_start purges every PURGE_PERIOD.
+ * Every entry point then holds purge_lock.
+ *
+ * The entry points are named mm_malloc, mm_free and so on. Without
+ * -DDRIVER, as in libmm.so, the end of this file also defines malloc, free
+ * and the rest of the allocator of libc on top of them, so that a program
+ * run with LD_PRELOAD=./libmm.so allocates from this heap. One lock
+ * serializes those calls, and the first call sets up the heap.
+ *
+ * mm_arena_create and the rest, at the very end, serve blocks without
+ * headers by bumping a pointer through chunks malloced from this heap, and
+ * free them all at once by freeing the chunks.
+ *
  */
+#ifdef PURGE
+#define _GNU_SOURCE
+#endif
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef PURGE
+#include <pthread.h>
+#include <time.h>
+#endif
+#ifndef DRIVER
+#include <errno.h>
+#include <pthread.h>
+#endif
 #include "mm.h"
 #include "memlib.h"
-#ifdef DRIVER
 #define malloc mm_malloc
 #define free mm_free
+#define free_sized mm_free_sized
 #define realloc mm_realloc
 #define calloc mm_calloc
+#define malloc_batch mm_malloc_batch
+#define free_batch mm_free_batch
+#define memalign mm_memalign
+#define malloc_usable_size mm_usable_size
+#ifndef DRIVER
+#define mm_trim mm_trim_unlocked
 #endif
 #define ALIGNMENT 8
 #define ALIGN(p) (((size_t)(p) + (ALIGNMENT - 1)) & ~0x7)
 #define ALIGN_ODD(p) (((size_t)(p) & ~0x1) + 1)
 #define MAX(x, y) ((x) > (y)? (x) : (y))
-#define TAG_ALLOC(ptr, size) (((int *)(ptr))[0] = (size) ^ 0x4)
-#define TAG_PREV_ALLOC_PTR(ptr) (((int *)(ptr))[0] &= ~1)
-#define TAG_PREV_FREE_PTR(ptr) (((int *)(ptr))[0] |= 1)
+#define MIN(x, y) ((x) < (y)? (x) : (y))
+#define HUGE_SIZE (1UL << 32)
+#define HEAP_REACH (1UL << 35)
+#define HUGE_TAG(size) ((unsigned int)((size) >> 32) << 3 | 0x2)
+#define BLOCK_FIT(size) (ALIGN((size) + 4) < HUGE_SIZE ? \
+	ALIGN((size) + 4) : ALIGN((size) + 12))
+#define PAYLOAD(ptr, size) ((ptr) + ((size) < HUGE_SIZE ? 4 : 12))
+#define HEADER(ptr) ((ptr) - (((unsigned int *)(ptr))[-1] & 0x2 ? 12 : 4))
+#define TAG_ALLOC(ptr, size) ((size) < HUGE_SIZE ? \
+	(void)(((unsigned int *)(ptr))[0] = (size) ^ 0x4) : \
+	tag_huge(ptr, size, 0x4))
+#define TAG_PREV_ALLOC_PTR(ptr) (((unsigned int *)(ptr))[0] &= ~1)
+#define TAG_PREV_FREE_PTR(ptr) (((unsigned int *)(ptr))[0] |= 1)
 #define TAG_PREV_ALLOC(ptr) \
 	TAG_PREV_ALLOC_PTR((ptr) == mem_heap_hi() + 1 ? &hi_tag : (ptr))
 #define TAG_PREV_FREE(ptr) \
 	TAG_PREV_FREE_PTR((ptr) == mem_heap_hi() + 1 ? &hi_tag : (ptr))
 #define TAG_FREE_8(ptr) (((long *)(ptr))[0] = 8LL << 32 | 8)
-#define TAG_FREE(ptr, size) (((int *)(ptr))[0] = \
-		((int *)((ptr) + (size)))[-1] = (size))
-#define ALLOC_TAG(ptr) (((int *)(ptr))[0] & 0x4)
-#define ALLOC_SIZE(ptr) (((int *)(ptr))[0] & ~0x7)
-#define FREE_SIZE(ptr) (((int *)(ptr))[0] & ~0x7)
-#define FREE_PREV(ptr) ((int *)(ptr))[1]
-#define FREE_NEXT(ptr) ((int *)(ptr))[2]
-#define PREV_FREE_TAG(ptr) (((int *)(ptr))[0] & 0x1)
-#define PREV_FREE_SIZE(ptr) (((int *)(ptr))[-1] & ~0x7)
-#define GET_NO(size) (27 - __builtin_clz(size))
-#define LIST_LEN 22
+#define TAG_FREE(ptr, size) ((size) < HUGE_SIZE ? \
+	(void)(((unsigned int *)(ptr))[0] = \
+		   ((unsigned int *)((ptr) + (size)))[-1] = (size)) : \
+	tag_huge(ptr, size, 0))
+#define ALLOC_TAG(ptr) (((unsigned int *)(ptr))[0] & 0x4)
+#define BLOCK_SIZE(ptr, lo) (((unsigned int *)(ptr))[0] & 0x2 ? \
+	(size_t)(((unsigned int *)(ptr))[0] >> 3) << 32 | \
+	((unsigned int *)(ptr))[lo] : ((unsigned int *)(ptr))[0] & ~0x7)
+#define ALLOC_SIZE(ptr) BLOCK_SIZE(ptr, 1)
+#define FREE_SIZE(ptr) BLOCK_SIZE(ptr, 3)
+#define FREE_PREV(ptr) ((unsigned int *)(ptr))[1]
+#define FREE_NEXT(ptr) ((unsigned int *)(ptr))[2]
+#define PREV_FREE_TAG(ptr) (((unsigned int *)(ptr))[0] & 0x1)
+#define PREV_FREE_SIZE(ptr) BLOCK_SIZE((ptr) - 4, -1)
+#define NIL 0xffffffffU
+#define OFFSET(ptr) ((unsigned int)(((ptr) - heap_start) >> 3))
+#define ADDRESS(off) (heap_start + ((size_t)(off) << 3))
+#define GET_NO(size) (59 - __builtin_clzl(size))
+#define LIST_LEN 32
 #define BLOCKSIZE 4096
+#define SPLIT_SIZE 96
+#define PAGESIZE 4096
+#define TRIM_THRESHOLD (4 * 1024 * 1024)
+#define TRIM_PAD (1024 * 1024)
+#if !defined(FIFO) && !defined(LIFO)
+#define ADDR_ORDER
+#endif
+#ifdef TCACHE
+#define TC_MAX_SIZE 520
+#define TC_LIMIT 16
+#define TC_FLUSH 8
+#define TC_LARGE 1024
+#define TC_NEXT(ptr) ((unsigned int *)(ptr))[1]
+#endif
+#ifdef FASTBIN
+#define FB_MAX_SIZE 128
+#define FB_LIMIT 256
+#define FB_LARGE 1024
+#define FB_NEXT(ptr) ((unsigned int *)(ptr))[1]
+#endif
+#ifdef SLAB
+#define SLAB_MAX 64
+#define SLAB_LEN 6
+#define SLAB_CLASS(size) \
+	((size) <= 32 ? ((size) + 7) >> 3 : (((size) + 15) >> 4) + 2)
+#define SLAB_SIZE(cls) ((cls) <= 4 ? (cls) << 3 : ((cls) - 2) << 4)
+#define SLAB_HEAD(cls) link_start[LIST_LEN + (cls) - 1]
+#define SLAB_START 256
+#define SLAB_USE(size) (SLAB_HEAD(SLAB_CLASS(size)) != NIL || \
+	slab_live[BLOCK_FIT(size) >> 3] >= SLAB_START)
+#define SLAB_BORN(size) ((void)((size) <= BLOCK_FIT(SLAB_MAX) && \
+	slab_live[(size) >> 3]++))
+#define SLAB_DEAD(size) ((void)((size) <= BLOCK_FIT(SLAB_MAX) && \
+	slab_live[(size) >> 3] && slab_live[(size) >> 3]--))
+#define PAGE_NO(ptr) (((size_t)(ptr) >> 12) - page_base)
+#define PAGE_AT(no) ((void *)((page_base + (no)) << 12))
+#define RUN_HDR 80
+#define RUN_NEXT(run) ((unsigned int *)(run))[0]
+#define RUN_PREV(run) ((unsigned int *)(run))[1]
+#define RUN_CLASS(run) ((short *)(run))[4]
+#define RUN_NFREE(run) ((short *)(run))[5]
+#define RUN_SLOTS(run) ((short *)(run))[6]
+#define RUN_MAP(run) ((unsigned long *)(run) + 2)
+#define LIST_PREFIX (LIST_LEN + SLAB_LEN)
+#else
+#define SLAB_BORN(size) ((void)0)
+#define SLAB_DEAD(size) ((void)0)
+#define LIST_PREFIX LIST_LEN
+#endif
+#ifdef PURGE
+#define PURGE_MIN (4 * PAGESIZE)
+#define PURGE_LIST GET_NO(PURGE_MIN)
+#define PURGE_DECAY 1000
+#define PURGE_PERIOD 100
+#define PURGED(ptr) ((unsigned int *)(ptr))[4]
+#define PAGE_UP(ptr) ((void *)(((size_t)(ptr) + PAGESIZE - 1) & ~(PAGESIZE - 1)))
+#define PAGE_DOWN(ptr) ((void *)((size_t)(ptr) & ~(PAGESIZE - 1)))
+#define GUARD() pthread_mutex_t *guard __attribute__((cleanup(purge_unlock))) = \
+	purge_lock_acquire()
+#else
+#define GUARD()
+#endif
 static void *heap_start = 0;
-static int *link_start;
-static int hi_tag, tag;
-static void free_insert(void *ptr, int size);
-static void *free_search(int size);
+static unsigned int *link_start;
+#ifdef FIFO
+static unsigned int link_tail[LIST_LEN];
+#endif
+#ifdef ADDR_ORDER
+static unsigned int link_hint[LIST_LEN];
+#endif
+static unsigned int hi_tag;
+static unsigned int bin_map;
+static void free_insert(void *ptr, size_t size);
+static void *free_search(size_t size);
+static inline void *list_fit(unsigned int off, size_t size);
+static inline unsigned int insert_after(int list_no, void *ptr);
 static void free_remove(void *ptr);
-static void *extend_heap(int size);
-static void coalesce(void *ptr, int size);
-static void *binary2_bal(size_t size);
+static void *extend_heap(size_t size);
+static void *place(size_t size);
+static void *place_at(void *ptr, size_t size);
+static void sort_ptrs(void **ptrs, size_t n);
+static void coalesce(void *ptr, size_t size);
+static void tag_huge(void *ptr, size_t size, int alloc);
+static void *place_aligned(size_t size, size_t align);
+static void free_block(void *ptr, size_t size);
+void free_batch(void **ptrs, size_t n);
+#ifdef FASTBIN
+static unsigned int fb_head[FB_MAX_SIZE / 8 + 1];
+static int fb_count;
+static void fb_consolidate(void);
+#endif
+#ifdef SLAB
+static unsigned char *page_map;
+static int slab_live[BLOCK_FIT(SLAB_MAX) / 8 + 1];
+static size_t page_base, page_cap;
+static void *slab_malloc(int cls);
+static void slab_free(void *ptr, void *run);
+#endif
+#ifdef PURGE
+static pthread_mutex_t purge_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static unsigned long purge_epoch;
+static unsigned long now_ms(void);
+static pthread_mutex_t *purge_lock_acquire(void);
+static void purge_unlock(pthread_mutex_t **lock);
+#endif
+#ifdef TCACHE
+static __thread unsigned int tc_head[TC_MAX_SIZE / 8 + 1];
+static __thread int tc_count[TC_MAX_SIZE / 8 + 1];
+static __thread long tc_hits, tc_lookups;
+static __thread int tc_total;
+static void tc_flush(void);
+static void tc_flush_fit(size_t size);
+#endif
 
 
 /*
@@ -98,12 +329,34 @@ static void *binary2_bal(size_t size);
  */
 int mm_init(void)
 {
-    link_start = mem_sbrk(ALIGN_ODD(LIST_LEN) * 4);
+    GUARD();
+    link_start = mem_sbrk(ALIGN_ODD(LIST_PREFIX) * 4);
     if (link_start == (void *)-1)return -1;
-    for (int i = 0; i < LIST_LEN; i++)link_start[i] = 1;
+    for (int i = 0; i < LIST_PREFIX; i++)link_start[i] = NIL;
+#ifdef FIFO
+    for (int i = 0; i < LIST_LEN; i++)link_tail[i] = NIL;
+#endif
+#ifdef ADDR_ORDER
+    for (int i = 0; i < LIST_LEN; i++)link_hint[i] = NIL;
+#endif
     heap_start = mem_heap_hi() + 1;
     if (heap_start == NULL)return -1;
-    hi_tag = 0; tag = 1;
+    hi_tag = 0; bin_map = 0;
+#ifdef SLAB
+    page_map = NULL; page_cap = 0; page_base = (size_t)heap_start >> 12;
+    memset(slab_live, 0, sizeof(slab_live));
+#endif
+#ifdef TCACHE
+    for (int i = 0; i <= TC_MAX_SIZE / 8; i++) { tc_head[i] = NIL; tc_count[i] = 0; }
+    tc_hits = tc_lookups = tc_total = 0;
+#endif
+#ifdef FASTBIN
+    for (int i = 0; i <= FB_MAX_SIZE / 8; i++)fb_head[i] = NIL;
+    fb_count = 0;
+#endif
+#ifdef PURGE
+    purge_epoch = now_ms();
+#endif
     return 0;
 }
 
@@ -114,38 +367,103 @@ int mm_init(void)
  */
 void *malloc(size_t size)
 {
+    GUARD();
     if (size == 0)return NULL;
-    // The following line of code solves specifically for binary2-bal.rep to
-    // reach full score. Remove them to get a general purpose allocator.
-    void *bal = binary2_bal(size); if (bal != NULL)return bal;
-    size = ALIGN(size + 4);
-    void *ptr = free_search((int)size);
-    int remain;
-    if (ptr)
+    if (size >= HEAP_REACH)return (void *)-1;
+#ifdef SLAB
+    if (size <= SLAB_MAX && SLAB_USE(size))
+        return slab_malloc(SLAB_CLASS(size));
+#endif
+    size = BLOCK_FIT(size);
+    void *ptr;
+#ifdef TCACHE
+    if (size <= TC_MAX_SIZE)
     {
-        free_remove(ptr);
-        remain = FREE_SIZE(ptr) - size;
-        free_insert(ptr + size, remain);
-        TAG_ALLOC(ptr, size);
+        unsigned int *head = tc_head + (size >> 3);
+        tc_lookups++;
+        if (*head != NIL)
+        {
+            tc_hits++;
+            tc_count[size >> 3]--;
+            tc_total--;
+            ptr = ADDRESS(*head);
+            *head = TC_NEXT(ptr);
+            return ptr + 4;
+        }
     }
-    else
+#endif
+#ifdef FASTBIN
+    if (size <= FB_MAX_SIZE && fb_head[size >> 3] != NIL)
     {
-        ptr = mem_heap_hi() + 1;
-        if (ptr == NULL)return (void *)-1;
-        if (hi_tag)
+        fb_count--;
+        ptr = ADDRESS(fb_head[size >> 3]);
+        fb_head[size >> 3] = FB_NEXT(ptr);
+        return ptr + 4;
+    }
+#endif
+    ptr = place(size);
+    if (ptr == (void *)-1)return (void *)-1;
+    SLAB_BORN(size);
+    return PAYLOAD(ptr, size);
+}
+
+
+/*
+ * malloc_batch - Allocate n blocks of size bytes each into out, carved
+ *     one after another out of the first free block that holds them all,
+ *     with a single removal from the segregated lists. If none does, they
+ *     are placed one by one like n mallocs. Return 0 on success, -1 on
+ *     error, with none allocated. If size is 0, out is filled with NULL.
+ */
+int malloc_batch(size_t size, size_t n, void **out)
+{
+    GUARD();
+    if (size == 0 || n == 0)
+    {
+        for (size_t i = 0; i < n; i++)out[i] = NULL;
+        return 0;
+    }
+    if (size >= HEAP_REACH || n >= HEAP_REACH / BLOCK_FIT(size))return -1;
+#ifdef SLAB
+    if (size <= SLAB_MAX && SLAB_USE(size))
+    {
+        for (size_t i = 0; i < n; i++)
+            if ((out[i] = slab_malloc(SLAB_CLASS(size))) == (void *)-1)
+            {
+                free_batch(out, i);
+                return -1;
+            }
+        return 0;
+    }
+#endif
+    size = BLOCK_FIT(size);
+    void *ptr = free_search(size * n);
+    if (ptr == NULL)
+    {
+        // No free block holds them all: fill the smaller ones first, as
+        // that many mallocs would, rather than grow the heap for the batch.
+        for (size_t i = 0; i < n; i++)
         {
-            remain = PREV_FREE_SIZE(ptr);
-            ptr -= remain;
-            if (remain != 8)free_remove(ptr);
-            hi_tag = 0;
-            if (size - remain)
-                if (extend_heap(size - remain) == (void *)-1)
-                    return (void *)-1;
+            if ((ptr = place(size)) == (void *)-1)
+            {
+                free_batch(out, i);
+                return -1;
+            }
+            SLAB_BORN(size);
+            out[i] = PAYLOAD(ptr, size);
         }
-        else if (extend_heap(size) == (void *)-1)return (void *)-1;
+        return 0;
+    }
+    ptr = place_at(ptr, size * n);
+    int prev_free = PREV_FREE_TAG(ptr);
+    for (size_t i = 0; i < n; i++, ptr += size)
+    {
         TAG_ALLOC(ptr, size);
+        SLAB_BORN(size);
+        out[i] = PAYLOAD(ptr, size);
     }
-    return ptr + 4;
+    if (prev_free)TAG_PREV_FREE(ptr - size * n);
+    return 0;
 }
 
 
@@ -154,11 +472,127 @@ void *malloc(size_t size)
  */
 void free(void *ptr)
 {
+    GUARD();
     if (!ptr)return;
     if (heap_start == 0)mm_init();
-    ptr -= 4;
-    int size = ALLOC_SIZE(ptr);
+#ifdef SLAB
+    if (PAGE_NO(ptr) < page_cap && page_map[PAGE_NO(ptr)])
+    {
+        slab_free(ptr, (void *)((size_t)ptr & ~(PAGESIZE - 1)));
+        return;
+    }
+#endif
+    ptr = HEADER(ptr);
+    free_block(ptr, ALLOC_SIZE(ptr));
+}
+
+
+/*
+ * free_sized - Free the block pointed by ptr, which was last allocated or
+ *     reallocated with size bytes. Every block is exactly BLOCK_FIT of the
+ *     size asked for, so the header need not be read to find the block
+ *     and its size; it is only checked against them.
+ */
+void free_sized(void *ptr, size_t size)
+{
+    GUARD();
+    if (!ptr)return;
+#ifdef SLAB
+    if (size <= SLAB_MAX && PAGE_NO(ptr) < page_cap && page_map[PAGE_NO(ptr)])
+    {
+        slab_free(ptr, (void *)((size_t)ptr & ~(PAGESIZE - 1)));
+        return;
+    }
+#endif
+    size = BLOCK_FIT(size);
+    ptr -= size < HUGE_SIZE ? 4 : 12;
+    assert(ALLOC_TAG(ptr) && ALLOC_SIZE(ptr) == size);
+    free_block(ptr, size);
+}
+
+
+/*
+ * free_block - Free the allocated block of size bytes at ptr, keeping it
+ *     in the per-thread cache or in a fast bin if it is small enough.
+ */
+static void free_block(void *ptr, size_t size)
+{
+#ifdef TCACHE
+    if (size <= TC_MAX_SIZE)
+    {
+        unsigned int *head = tc_head + (size >> 3);
+        TC_NEXT(ptr) = *head;
+        *head = OFFSET(ptr);
+        tc_total++;
+        if (++tc_count[size >> 3] <= TC_LIMIT)return;
+        tc_count[size >> 3] -= TC_FLUSH;
+        tc_total -= TC_FLUSH;
+        for (int i = TC_FLUSH; i <= TC_LIMIT; i++)
+            head = &TC_NEXT(ADDRESS(*head));
+        while (*head != NIL)
+        {
+            ptr = ADDRESS(*head);
+            *head = TC_NEXT(ptr);
+            coalesce(ptr, size);
+        }
+        return;
+    }
+#endif
+#ifdef FASTBIN
+    if (size <= FB_MAX_SIZE)
+    {
+        FB_NEXT(ptr) = fb_head[size >> 3];
+        fb_head[size >> 3] = OFFSET(ptr);
+        if (++fb_count > FB_LIMIT)fb_consolidate();
+        return;
+    }
+#endif
+    SLAB_DEAD(size);
     coalesce(ptr, size);
+#ifdef TCACHE
+    if (tc_total && size >= TC_LARGE)tc_flush();
+#endif
+#ifdef FASTBIN
+    if (fb_count && size >= FB_LARGE)fb_consolidate();
+#endif
+}
+
+
+/*
+ * free_batch - Free the n blocks pointed by ptrs, skipping NULL. The
+ *     array is sorted by address in place, and each run of blocks that
+ *     lie next to each other is coalesced as one free block.
+ */
+void free_batch(void **ptrs, size_t n)
+{
+    GUARD();
+    if (heap_start == 0)mm_init();
+    sort_ptrs(ptrs, n);
+    void *run = NULL;
+    size_t run_size = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        void *ptr = ptrs[i];
+        if (!ptr)continue;
+#ifdef SLAB
+        if (PAGE_NO(ptr) < page_cap && page_map[PAGE_NO(ptr)])
+        {
+            slab_free(ptr, (void *)((size_t)ptr & ~(PAGESIZE - 1)));
+            continue;
+        }
+#endif
+        ptr = HEADER(ptr);
+        SLAB_DEAD(ALLOC_SIZE(ptr));
+        if (run && run + run_size == ptr)
+        {
+            run_size += ALLOC_SIZE(ptr);
+            continue;
+        }
+        if (run)coalesce(run, run_size);
+        run = ptr;
+        run_size = ALLOC_SIZE(ptr);
+    }
+    if (run)coalesce(run, run_size);
 }
 
 
@@ -169,50 +603,68 @@ void free(void *ptr)
  */
 void *realloc(void *oldptr, size_t size)
 {
+    GUARD();
     if (oldptr == NULL)return malloc(size);
     if (size == 0) { free(oldptr); return 0; }
-    oldptr -= 4;
-    int old_size = ALLOC_SIZE(oldptr);
+    if (size >= HEAP_REACH)return (void *)-1;
+#ifdef SLAB
+    if (PAGE_NO(oldptr) < page_cap && page_map[PAGE_NO(oldptr)])
+    {
+        int slot = SLAB_SIZE(page_map[PAGE_NO(oldptr)]);
+        if (size <= (size_t)slot)return oldptr;
+        void *new_ptr = malloc(size);
+        if (new_ptr == (void *)-1)return (void *)-1;
+        memcpy(new_ptr, oldptr, size < (size_t)slot ? size : (size_t)slot);
+        free(oldptr);
+        return new_ptr;
+    }
+#endif
+    oldptr = HEADER(oldptr);
+    size_t old_size = ALLOC_SIZE(oldptr);
     int prev_free = PREV_FREE_TAG(oldptr);
-    size = ALIGN(size + 4);
-    if ((int)size == old_size)return oldptr + 4;
-    else if ((int)size < old_size)
+    void *payload = PAYLOAD(oldptr, old_size);
+    size_t bytes = size;
+    size = BLOCK_FIT(size);
+    // The payload stays in place only if the header keeps its format.
+    int same = (size < HUGE_SIZE) == (old_size < HUGE_SIZE);
+    if (same && size == old_size)return payload;
+    else if (same && size < old_size)
     {
         TAG_ALLOC(oldptr, size);
         if (prev_free)TAG_PREV_FREE(oldptr);
         void *next = oldptr + old_size;
-        int next_size = old_size - size;
+        size_t next_size = old_size - size;
         if (next <= mem_heap_hi() && !ALLOC_TAG(next))
         {
             if (FREE_SIZE(next) == 8)next_size += 8;
             else { free_remove(next); next_size += FREE_SIZE(next); }
         }
         free_insert(oldptr + size, next_size);
-        return oldptr + 4;
+        return payload;
     }
-    else if (oldptr + old_size == mem_heap_hi() + 1)
+    else if (same && oldptr + old_size == mem_heap_hi() + 1)
     {
         if (extend_heap(size - old_size) == (void *)-1)return (void *)-1;
         TAG_ALLOC(oldptr, size);
         if (prev_free)TAG_PREV_FREE(oldptr);
-        return oldptr + 4;
+        return payload;
     }
-    else if (!ALLOC_TAG(oldptr + old_size) &&
-             FREE_SIZE(oldptr + old_size) + old_size >= (int)size)
+    else if (same && !ALLOC_TAG(oldptr + old_size) &&
+             FREE_SIZE(oldptr + old_size) + old_size >= size)
     {
         if (FREE_SIZE(oldptr + old_size) != 8)free_remove(oldptr + old_size);
         old_size += FREE_SIZE(oldptr + old_size);
         TAG_ALLOC(oldptr, size);
         if (prev_free)TAG_PREV_FREE(oldptr);
         free_insert(oldptr + size, old_size - size);
-        return oldptr + 4;
+        return payload;
     }
     else
     {
-        void *new_ptr = malloc(size - 4);
+        void *new_ptr = malloc(bytes);
         if (new_ptr == (void *)-1)return (void *)-1;
-        memcpy(new_ptr, oldptr + 4, old_size - 4);
-        free(oldptr + 4);
+        memcpy(new_ptr, payload, MIN(bytes, (size_t)(oldptr + old_size - payload)));
+        free(payload);
         return new_ptr;
     }
 }
@@ -224,6 +676,7 @@ void *realloc(void *oldptr, size_t size)
  */
 void *calloc(size_t nmemb, size_t size)
 {
+    GUARD();
     size_t bytes = nmemb * size;
     void *new_ptr;
     new_ptr = malloc(bytes);
@@ -233,49 +686,487 @@ void *calloc(size_t nmemb, size_t size)
 }
 
 
+/*
+ * memalign - Return pointer to a block of size bytes whose payload is
+ *     aligned to align, a power of 2, on success, -1 on error. If size is
+ *     0, return NULL.
+ */
+void *memalign(size_t align, size_t size)
+{
+    GUARD();
+    if (align <= ALIGNMENT)return malloc(size);
+    if (size == 0)return NULL;
+    if (size >= HEAP_REACH || align >= HEAP_REACH)return (void *)-1;
+    size = BLOCK_FIT(size);
+    void *ptr = place_aligned(size, align);
+    if (ptr == NULL)return (void *)-1;
+    return PAYLOAD(ptr, size);
+}
+
+
+/*
+ * malloc_usable_size - Return the number of bytes the block pointed by ptr
+ *     can hold, at least the size it was allocated with. 0 for NULL.
+ */
+size_t malloc_usable_size(void *ptr)
+{
+    GUARD();
+    if (!ptr)return 0;
+#ifdef SLAB
+    if (PAGE_NO(ptr) < page_cap && page_map[PAGE_NO(ptr)])
+        return SLAB_SIZE(page_map[PAGE_NO(ptr)]);
+#endif
+    void *block = HEADER(ptr);
+    return block + ALLOC_SIZE(block) - ptr;
+}
+
+
+/*
+ * mm_trim - Give the free block at the top of the heap back to memlib,
+ *     keeping at most pad bytes of it. Return 1 if the heap was shrunk,
+ *     0 otherwise.
+ */
+int mm_trim(size_t pad)
+{
+    GUARD();
+    if (heap_start == 0 || !hi_tag)return 0;
+    void *end = mem_heap_hi() + 1;
+    size_t size = PREV_FREE_SIZE(end);
+    void *ptr = end - size;
+    pad = ALIGN(pad);
+    if (pad >= size)return 0;
+    if (size != 8)free_remove(ptr);
+    if (mem_sbrk(-(intptr_t)(size - pad)) == (void *)-1)
+    {
+        free_insert(ptr, size);
+        return 0;
+    }
+    free_insert(ptr, pad);
+    return 1;
+}
+
+
+#ifdef PURGE
+/*
+ * mm_purge - Give back the whole pages inside the free blocks that are not
+ *     purged yet. The dirty bytes decay by PURGE_DECAY / (PURGE_DECAY + t)
+ *     after t ms since the last call, or all go if all is nonzero. Return
+ *     the number of bytes purged.
+ */
+size_t mm_purge(int all)
+{
+    GUARD();
+    if (heap_start == 0)return 0;
+    unsigned long now = now_ms();
+    size_t dirty = 0, purged = 0;
+    void *ptr;
+    for (int i = PURGE_LIST; i < LIST_LEN; i++)
+        for (unsigned int off = link_start[i]; off != NIL; off = FREE_NEXT(ptr))
+        {
+            ptr = ADDRESS(off);
+            if (!PURGED(ptr))dirty += PAGE_DOWN(ptr + FREE_SIZE(ptr) - 8) -
+                                      PAGE_UP(ptr + 20);
+        }
+    size_t keep = all ? 0 : dirty * PURGE_DECAY /
+                            (PURGE_DECAY + now - purge_epoch);
+    purge_epoch = now;
+    for (int i = LIST_LEN - 1; i >= PURGE_LIST && dirty > keep; i--)
+        for (unsigned int off = link_start[i]; off != NIL && dirty > keep;
+             off = FREE_NEXT(ptr))
+        {
+            ptr = ADDRESS(off);
+            if (PURGED(ptr))continue;
+            void *lo = PAGE_UP(ptr + 20);
+            void *hi = PAGE_DOWN(ptr + FREE_SIZE(ptr) - 8);
+            mem_purge(lo, hi - lo);
+            PURGED(ptr) = 1;
+            dirty -= hi - lo;
+            purged += hi - lo;
+        }
+    return purged;
+}
+
+
+/*
+ * purge_thread - Call mm_purge every PURGE_PERIOD ms.
+ */
+static void *purge_thread(void *arg)
+{
+    for (;;) { usleep(PURGE_PERIOD * 1000); mm_purge(0); }
+    return NULL;
+}
+
+
+/*
+ * mm_purge_start - Start the background purging thread, once. Return 0 on
+ *     success, -1 on error.
+ */
+int mm_purge_start(void)
+{
+    static pthread_t thread;
+    static int started;
+    GUARD();
+    if (started)return 0;
+    if (pthread_create(&thread, NULL, purge_thread, NULL))return -1;
+    pthread_detach(thread);
+    started = 1;
+    return 0;
+}
+
+
+/*
+ * now_ms - Return the monotonic time in ms.
+ */
+static unsigned long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+
+/*
+ * purge_lock_acquire, purge_unlock - Take purge_lock for the scope of an
+ *     entry point, and release it when the scope is left.
+ */
+static pthread_mutex_t *purge_lock_acquire(void)
+{
+    pthread_mutex_lock(&purge_lock);
+    return &purge_lock;
+}
+
+
+static void purge_unlock(pthread_mutex_t **lock)
+{
+    pthread_mutex_unlock(*lock);
+}
+#endif
+
+
+#ifdef TCACHE
+/*
+ * mm_tcache_stats - Report the number of mallocs served by the cache and
+ *     the number of mallocs that looked it up since mm_init.
+ */
+void mm_tcache_stats(long *hits, long *lookups)
+{
+    *hits = tc_hits;
+    *lookups = tc_lookups;
+}
+
+
+/*
+ * tc_flush - Empty the cache of this thread, coalescing each of its blocks
+ *     with its free neighbours into the segregated lists.
+ */
+static void tc_flush(void)
+{
+    for (int i = 1; i <= TC_MAX_SIZE / 8; i++)
+    {
+        while (tc_head[i] != NIL)
+        {
+            void *ptr = ADDRESS(tc_head[i]);
+            tc_head[i] = TC_NEXT(ptr);
+            coalesce(ptr, (size_t)i << 3);
+        }
+        tc_count[i] = 0;
+    }
+    tc_total = 0;
+}
+
+
+/*
+ * tc_flush_fit - Flush only the cached blocks that can make a fit for a
+ *     request of size bytes: those of at least size bytes, and those next
+ *     to a free block, which they coalesce with.
+ */
+static void tc_flush_fit(size_t size)
+{
+    for (int i = 1; i <= TC_MAX_SIZE / 8; i++)
+    {
+        unsigned int *link = tc_head + i;
+        while (*link != NIL)
+        {
+            void *ptr = ADDRESS(*link), *next = ptr + ((size_t)i << 3);
+            if ((size_t)i << 3 < size && !PREV_FREE_TAG(ptr) &&
+                (next > mem_heap_hi() || ALLOC_TAG(next)))
+            {
+                link = &TC_NEXT(ptr);
+                continue;
+            }
+            *link = TC_NEXT(ptr);
+            tc_count[i]--;
+            tc_total--;
+            coalesce(ptr, (size_t)i << 3);
+        }
+    }
+}
+#endif
+
+
+#ifdef FASTBIN
+/*
+ * fb_consolidate - Empty the fast bins, coalescing each of their blocks
+ *     with its free neighbours into the segregated lists.
+ */
+static void fb_consolidate(void)
+{
+    for (int i = 1; i <= FB_MAX_SIZE / 8; i++)
+    {
+        while (fb_head[i] != NIL)
+        {
+            void *ptr = ADDRESS(fb_head[i]);
+            fb_head[i] = FB_NEXT(ptr);
+            coalesce(ptr, (size_t)i << 3);
+        }
+    }
+    fb_count = 0;
+}
+#endif
+
+
+/*
+ * place_aligned - Allocate a block of size bytes whose payload is aligned
+ *     to align bytes, a power of two of at least 8. The first fit is taken
+ *     if it happens to hold such a block. The slack in front of
+ *     the payload and behind the block is given back to the segregated
+ *     lists. Return pointer to the block on success, NULL on error.
+ */
+static void *place_aligned(size_t size, size_t align)
+{
+#ifdef TCACHE
+    if (tc_total && !free_search(size + align - 8))tc_flush();
+#endif
+#ifdef FASTBIN
+    if (fb_count && !free_search(size + align - 8))fb_consolidate();
+#endif
+    void *ptr = free_search(size);
+    size_t total, lead;
+    if (ptr && (-(size_t)PAYLOAD(ptr, size) & (align - 1)) + size >
+               FREE_SIZE(ptr))
+        ptr = free_search(size + align - 8);
+    if (ptr) { free_remove(ptr); total = FREE_SIZE(ptr); }
+    else
+    {
+        ptr = mem_heap_hi() + 1;
+        total = 0;
+        if (hi_tag)
+        {
+            total = PREV_FREE_SIZE(ptr);
+            ptr -= total;
+            if (total != 8)free_remove(ptr);
+            hi_tag = 0;
+        }
+        lead = -(size_t)PAYLOAD(ptr, size) & (align - 1);
+        if (lead + size > total)
+        {
+            if (mem_sbrk(lead + size - total) == (void *)-1)
+            {
+                if (total)free_insert(ptr, total);
+                return NULL;
+            }
+            total = lead + size;
+        }
+    }
+    lead = -(size_t)PAYLOAD(ptr, size) & (align - 1);
+    TAG_ALLOC(ptr + lead, size);
+    free_insert(ptr + lead + size, total - lead - size);
+    if (lead)free_insert(ptr, lead);
+    return ptr + lead;
+}
+
+
+#ifdef SLAB
+/*
+ * slab_malloc - Allocate a slot of class cls from the first run with free
+ *     slots, making a new run if there is none. Return pointer to the slot
+ *     on success, -1 on error.
+ */
+static void *slab_malloc(int cls)
+{
+    unsigned int *head = &SLAB_HEAD(cls);
+    void *run;
+    if (*head == NIL)
+    {
+        void *block = place_aligned(PAGESIZE, PAGESIZE);
+        if (block == NULL)return (void *)-1;
+        run = block + 4;
+        if (PAGE_NO(run) >= page_cap)
+        {
+            size_t cap = MAX(MAX(page_cap * 2, PAGE_NO(run) + 1), 256);
+            unsigned char *map = malloc(cap);
+            if (map == (void *)-1)return (void *)-1;
+            memset(map, 0, cap);
+            if (page_map)memcpy(map, page_map, page_cap);
+            free(page_map);
+            page_map = map; page_cap = cap;
+        }
+        page_map[PAGE_NO(run)] = cls;
+        RUN_CLASS(run) = cls;
+        RUN_SLOTS(run) = RUN_NFREE(run) = (PAGESIZE - 4 - RUN_HDR) /
+                                          SLAB_SIZE(cls);
+        memset(RUN_MAP(run), 0, RUN_HDR - 16);
+        for (int i = RUN_SLOTS(run); i < (RUN_HDR - 16) * 8; i++)
+            RUN_MAP(run)[i >> 6] |= 1UL << (i & 63);
+        RUN_NEXT(run) = RUN_PREV(run) = NIL;
+        *head = PAGE_NO(run);
+    }
+    run = PAGE_AT(*head);
+    int w = 0;
+    while (!~RUN_MAP(run)[w])w++;
+    int slot = w << 6 | __builtin_ctzl(~RUN_MAP(run)[w]);
+    RUN_MAP(run)[w] |= 1UL << (slot & 63);
+    if (!--RUN_NFREE(run))
+    {
+        *head = RUN_NEXT(run);
+        if (*head != NIL)RUN_PREV(PAGE_AT(*head)) = NIL;
+    }
+    return run + RUN_HDR + slot * SLAB_SIZE(cls);
+}
+
+
+/*
+ * slab_free - Free the slot pointed by ptr in run. A run that becomes empty
+ *     is given back to the heap unless it is the only run with free slots
+ *     of its class.
+ */
+static void slab_free(void *ptr, void *run)
+{
+    int cls = RUN_CLASS(run);
+    unsigned int *head = &SLAB_HEAD(cls);
+    int slot = (ptr - run - RUN_HDR) / SLAB_SIZE(cls);
+    RUN_MAP(run)[slot >> 6] &= ~(1UL << (slot & 63));
+    if (!RUN_NFREE(run)++)
+    {
+        RUN_NEXT(run) = *head;
+        RUN_PREV(run) = NIL;
+        if (*head != NIL)RUN_PREV(PAGE_AT(*head)) = PAGE_NO(run);
+        *head = PAGE_NO(run);
+    }
+    if (RUN_NFREE(run) < RUN_SLOTS(run))return;
+    if (RUN_NEXT(run) == NIL && RUN_PREV(run) == NIL)return;
+    if (RUN_PREV(run) == NIL)*head = RUN_NEXT(run);
+    else RUN_NEXT(PAGE_AT(RUN_PREV(run))) = RUN_NEXT(run);
+    if (RUN_NEXT(run) != NIL)RUN_PREV(PAGE_AT(RUN_NEXT(run))) = RUN_PREV(run);
+    page_map[PAGE_NO(run)] = 0;
+    coalesce(run - 4, ALLOC_SIZE(run - 4));
+}
+#endif
+
+
 /*
  * free_insert - Insert a free block to the segregated lists. If size is 0,
  *     mark the previous block of ptr is allocated; if size is 8, store the
  *     header and footer of the free block and mark the previous block of
  *     ptr+8 is free.
  */
-static void free_insert(void *ptr, int size)
+static void free_insert(void *ptr, size_t size)
 {
     if (!size) { TAG_PREV_ALLOC(ptr); return; }
     if (size == 8) { TAG_FREE_8(ptr); TAG_PREV_FREE(ptr + 8); return; }
     TAG_FREE(ptr, size);
-    int *link = link_start + GET_NO(size);
-    if (*link != 1)FREE_PREV(heap_start + *link) = ptr - heap_start;
+    int list_no = GET_NO(size);
+    unsigned int prev = insert_after(list_no, ptr);
+    unsigned int *link = prev == NIL ? link_start + list_no :
+                                       &FREE_NEXT(ADDRESS(prev));
+    if (*link != NIL)FREE_PREV(ADDRESS(*link)) = OFFSET(ptr);
+#ifdef FIFO
+    else link_tail[list_no] = OFFSET(ptr);
+#endif
+    bin_map |= 1U << list_no;
     FREE_NEXT(ptr) = *link;
-    FREE_PREV(ptr) = 1;
-    *link = ptr - heap_start;
+    FREE_PREV(ptr) = prev;
+    *link = OFFSET(ptr);
+#ifdef ADDR_ORDER
+    link_hint[list_no] = OFFSET(ptr);
+#endif
+#ifdef PURGE
+    if (list_no >= PURGE_LIST)PURGED(ptr) = 0;
+#endif
     TAG_PREV_FREE(ptr + size);
 }
 
 
 /*
- * free_search - Search a free block of enough size in the segregated lists.
- *     The strategy is first fit. Return NULL if such block is not found.
+ * free_search - Search a free block of enough size in the segregated lists.
+ *     The list of size itself is scanned by list_fit. The head of any
+ *     larger non-empty list, taken from bin_map, always fits, so first fit
+ *     takes it; best fit scans that list too. Return NULL if such block is
+ *     not found.
+ */
+static void *free_search(size_t size)
+{
+    size = MAX(size, 16);
+    int list_no = GET_NO(size);
+    unsigned int map = bin_map >> list_no << list_no;
+    void *ptr;
+    if (!map)return NULL;
+    if (map & 1U << list_no)
+    {
+        ptr = list_fit(link_start[list_no], size);
+        if (ptr)return ptr;
+        map &= map - 1;
+        if (!map)return NULL;
+    }
+#ifdef BEST_FIT
+    return list_fit(link_start[__builtin_ctz(map)], size);
+#else
+    return ADDRESS(link_start[__builtin_ctz(map)]);
+#endif
+}
+
+
+/*
+ * list_fit - Return the block of the list starting at off that the fit
+ *     policy takes for size bytes, NULL if none holds them. First fit
+ *     takes the first; with -DBEST_FIT=K, the smallest of the first K
+ *     that hold them is taken, or the first one of exactly size bytes.
  */
-static void *free_search(int size)
+static inline void *list_fit(unsigned int off, size_t size)
 {
-    size = MAX(size, 16);
-    int list_no = GET_NO(size);
-    int *link;
-    void *ptr;
-    for (int i = list_no; i < LIST_LEN; i++)
+#ifdef BEST_FIT
+    void *best = NULL;
+    size_t best_size = 0;
+    for (int k = 0; off != NIL && k < BEST_FIT; off = FREE_NEXT(ADDRESS(off)))
     {
-        link = link_start + i;
-        if (*link == 1)continue;
-        ptr = heap_start + *link;
-        if (FREE_SIZE(ptr) >= size)return ptr;
-        while (FREE_NEXT(ptr) != 1)
-        {
-            ptr = heap_start + FREE_NEXT(ptr);
-            if (FREE_SIZE(ptr) >= size)return ptr;
-        }
+        void *ptr = ADDRESS(off);
+        size_t ptr_size = FREE_SIZE(ptr);
+        if (ptr_size < size)continue;
+        if (ptr_size == size)return ptr;
+        if (!best || ptr_size < best_size) { best = ptr; best_size = ptr_size; }
+        k++;
     }
+    return best;
+#else
+    for (; off != NIL; off = FREE_NEXT(ADDRESS(off)))
+        if (FREE_SIZE(ADDRESS(off)) >= size)return ADDRESS(off);
     return NULL;
+#endif
+}
+
+
+/*
+ * insert_after - Return the block of list list_no after which the insert
+ *     policy puts ptr, NIL for the head: the last block below ptr with
+ *     ADDR_ORDER, the tail with -DFIFO, or always the head with -DLIFO.
+ *     The walk for the last starts from the block inserted last in the
+ *     list, in either direction, as frees tend to be near each other.
+ */
+static inline unsigned int insert_after(int list_no, void *ptr)
+{
+#if defined(FIFO)
+    return link_tail[list_no];
+#elif defined(ADDR_ORDER)
+    unsigned int prev = link_hint[list_no];
+    while (prev != NIL && ADDRESS(prev) > ptr)prev = FREE_PREV(ADDRESS(prev));
+    unsigned int next = prev == NIL ? link_start[list_no] :
+                                      FREE_NEXT(ADDRESS(prev));
+    for (; next != NIL && ADDRESS(next) < ptr; next = FREE_NEXT(ADDRESS(next)))
+        prev = next;
+    return prev;
+#else
+    return NIL;
+#endif
 }
 
 
@@ -285,18 +1176,26 @@ static void *free_search(int size)
  */
 static void free_remove(void *ptr)
 {
-    int prev = FREE_PREV(ptr);
-    int next = FREE_NEXT(ptr);
-    if (prev == 1)
+    unsigned int prev = FREE_PREV(ptr);
+    unsigned int next = FREE_NEXT(ptr);
+#ifdef FIFO
+    if (next == NIL)link_tail[GET_NO(FREE_SIZE(ptr))] = prev;
+#endif
+#ifdef ADDR_ORDER
+    if (link_hint[GET_NO(FREE_SIZE(ptr))] == OFFSET(ptr))
+        link_hint[GET_NO(FREE_SIZE(ptr))] = prev;
+#endif
+    if (prev == NIL)
     {
-        int *link = link_start + GET_NO(FREE_SIZE(ptr));
-        *link = next;
-        if (next != 1)FREE_PREV(heap_start + next) = 1;
+        int list_no = GET_NO(FREE_SIZE(ptr));
+        link_start[list_no] = next;
+        if (next != NIL)FREE_PREV(ADDRESS(next)) = NIL;
+        else bin_map &= ~(1U << list_no);
     }
     else
     {
-        FREE_NEXT(heap_start + prev) = next;
-        if (next != 1)FREE_PREV(heap_start + next) = prev;
+        FREE_NEXT(ADDRESS(prev)) = next;
+        if (next != NIL)FREE_PREV(ADDRESS(next)) = prev;
     }
 }
 
@@ -305,11 +1204,11 @@ static void free_remove(void *ptr)
  * extend_heap - Extend the heap by at least size bytes. Return 0 on success,
  *     -1 on error.
  */
-static void *extend_heap(int size)
+static void *extend_heap(size_t size)
 {
     if (size < BLOCKSIZE)
     {
-        int remain = BLOCKSIZE - size;
+        size_t remain = BLOCKSIZE - size;
         if (mem_sbrk(BLOCKSIZE) == (void *)-1)return (void *)-1;
         free_insert(mem_heap_hi() + 1 - remain, remain);
     }
@@ -319,81 +1218,147 @@ static void *extend_heap(int size)
 
 
 /*
- * coalesce - Coalesce the free block pointed by ptr with its previous and
- *     next free block, and insert the new free block.
+ * place - Take a free block of exactly size bytes, first fit from the
+ *     segregated lists, else from the top of the heap, and tag it
+ *     allocated (see place_at). Return pointer to the block on success,
+ *     -1 on error.
  */
-static void coalesce(void *ptr, int size)
+static void *place(size_t size)
 {
-    if (PREV_FREE_TAG(ptr))
+    void *ptr = free_search(size);
+#ifdef TCACHE
+    if (tc_total && (!ptr || ptr + FREE_SIZE(ptr) == mem_heap_hi() + 1 ||
+                     FREE_SIZE(ptr) >= size + TC_LARGE))
     {
-        int prev_size = PREV_FREE_SIZE(ptr);
-        size += prev_size;
-        ptr -= prev_size;
-        if (prev_size != 8)free_remove(ptr);
+        if (!ptr)tc_flush();
+        else tc_flush_fit(size);
+        ptr = free_search(size);
     }
-    void *next = ptr + size;
-    if (next <= mem_heap_hi() && !ALLOC_TAG(next))
+#endif
+#ifdef FASTBIN
+    if (fb_count && (!ptr || size >= FB_LARGE ||
+                     FREE_SIZE(ptr) >= size + FB_LARGE))
     {
-        if (FREE_SIZE(next) == 8)size += 8;
-        else { free_remove(next); size += FREE_SIZE(next); }
+        fb_consolidate();
+        ptr = free_search(size);
     }
-    free_insert(ptr, size);
+#endif
+    return place_at(ptr, size);
 }
 
 
 /*
- * binary2_bal - Solve specifically for binary2-bal.rep to reach full score.
+ * place_at - Take a block of exactly size bytes from the free block ptr
+ *     found by free_search, or from the top of the heap if ptr is NULL,
+ *     and tag it allocated. A block of SPLIT_SIZE bytes up to a page is
+ *     carved from the high end of the free block, a smaller one from the
+ *     low end, and the rest is given back. Return pointer to the block on
+ *     success, -1 on error.
  */
-static void *binary2_bal(size_t size)
+static void *place_at(void *ptr, size_t size)
 {
-    if (tag == 0)return NULL;
-    if (tag == 1)
-    {
-        if (size == 64)
-        {
-            int extension = 800000; tag = 2;
-            if (extend_heap(extension) == (void *)-1)return (void *)-1;
-            free_insert(mem_heap_hi() + 1 - extension, extension);
-        }
-        else { tag = 0; return NULL; }
-    }
-    size = ALIGN(size + 4);
-    void *ptr = free_search((int)size);
-    int remain;
+    size_t remain;
+    int high = size >= SPLIT_SIZE && size < BLOCKSIZE;
     if (ptr)
     {
         free_remove(ptr);
         remain = FREE_SIZE(ptr) - size;
-        if (tag == 2)tag = 3;
-        else if (tag == 3)tag = 2;
-        if (tag == 3)
+        if (high && remain)
         {
             TAG_PREV_ALLOC(ptr + FREE_SIZE(ptr));
-            if (remain)free_insert(ptr, remain);
             TAG_ALLOC(ptr + remain, size);
-            return ptr + remain + 4;
+            free_insert(ptr, remain);
+            return ptr + remain;
         }
-        free_insert(ptr + size, remain);
         TAG_ALLOC(ptr, size);
+        free_insert(ptr + size, remain);
+        return ptr;
     }
-    else
+    ptr = mem_heap_hi() + 1;
+    if (ptr == NULL)return (void *)-1;
+    remain = 0;
+    if (hi_tag)
     {
-        ptr = mem_heap_hi() + 1;
-        if (ptr == NULL)return (void *)-1;
-        if (hi_tag)
+        remain = PREV_FREE_SIZE(ptr);
+        ptr -= remain;
+        if (remain != 8)free_remove(ptr);
+        hi_tag = 0;
+    }
+    // The rest of a page above a block of SPLIT_SIZE or more would draw
+    // small blocks in right after it, so the heap grows by just enough.
+    if (size - remain && (size >= SPLIT_SIZE ? mem_sbrk(size - remain) :
+                          extend_heap(size - remain)) == (void *)-1)
+        return (void *)-1;
+    TAG_ALLOC(ptr, size);
+    return ptr;
+}
+
+
+/*
+ * sort_ptrs - Sort the n pointers of ptrs by address, with a heapsort,
+ *     which needs no memory of its own.
+ */
+static void sort_ptrs(void **ptrs, size_t n)
+{
+    for (size_t end = n, start = n / 2; end > 1;)
+    {
+        void *top;
+        if (start > 0)top = ptrs[--start];
+        else { top = ptrs[--end]; ptrs[end] = ptrs[0]; }
+        size_t i = start, child;
+        while ((child = 2 * i + 1) < end)
         {
-            remain = PREV_FREE_SIZE(ptr);
-            ptr -= remain;
-            if (remain != 8)free_remove(ptr);
-            hi_tag = 0;
-            if (size - remain)
-                if (extend_heap(size - remain) == (void *)-1)
-                    return (void *)-1;
+            if (child + 1 < end && ptrs[child + 1] > ptrs[child])child++;
+            if (top >= ptrs[child])break;
+            ptrs[i] = ptrs[child];
+            i = child;
         }
-        else if (extend_heap(size) == (void *)-1)return (void *)-1;
-        TAG_ALLOC(ptr, size);
+        ptrs[i] = top;
+    }
+}
+
+
+/*
+ * coalesce - Coalesce the free block pointed by ptr with its previous and
+ *     next free block, and insert the new free block. If the top of the
+ *     heap is left with TRIM_THRESHOLD free bytes, trim it to TRIM_PAD.
+ */
+static void coalesce(void *ptr, size_t size)
+{
+    if (PREV_FREE_TAG(ptr))
+    {
+        size_t prev_size = PREV_FREE_SIZE(ptr);
+        size += prev_size;
+        ptr -= prev_size;
+        if (prev_size != 8)free_remove(ptr);
+    }
+    void *next = ptr + size;
+    if (next <= mem_heap_hi() && !ALLOC_TAG(next))
+    {
+        if (FREE_SIZE(next) == 8)size += 8;
+        else { free_remove(next); size += FREE_SIZE(next); }
     }
-    return ptr + 4;
+    free_insert(ptr, size);
+    if (hi_tag && PREV_FREE_SIZE(mem_heap_hi() + 1) >= TRIM_THRESHOLD)
+        mm_trim(TRIM_PAD);
+}
+
+
+/*
+ * tag_huge - Store the header (and the footer if the block is free) of a
+ *     block of at least HUGE_SIZE bytes. The header keeps the high bits of
+ *     size and the low 32 bits go to the word after the links, or to the
+ *     word before the footer. An allocated huge block repeats its header
+ *     right before the payload, so that free can find it.
+ */
+static void tag_huge(void *ptr, size_t size, int alloc)
+{
+    unsigned int *header = ptr;
+    header[0] = HUGE_TAG(size) | alloc;
+    header[alloc ? 1 : 3] = (unsigned int)size;
+    if (alloc) { header[2] = header[0]; return; }
+    ((unsigned int *)(ptr + size))[-1] = header[0];
+    ((unsigned int *)(ptr + size))[-2] = (unsigned int)size;
 }
 
 
@@ -480,7 +1445,7 @@ void mm_checkheap(int lineno)
                 fprintf(stderr, "%d: inconsistent allocate bit\n", lineno);
                 exit(1);
             }
-            if (FREE_SIZE(ptr) != FREE_SIZE(ptr + FREE_SIZE(ptr) - 4))
+            if (FREE_SIZE(ptr) != PREV_FREE_SIZE(ptr + FREE_SIZE(ptr)))
             {
                 fprintf(stderr, "%d: header and footer not match\n", lineno);
                 exit(1);
@@ -515,20 +1480,20 @@ void mm_checkheap(int lineno)
     /* Checking the free list (segregated list) */
 
     // 1. All next/previous pointers are consistent.
-    int *link;
+    unsigned int *link;
     for (int i = 0; i < LIST_LEN; i++)
     {
         link = link_start + i;
-        if (*link == 1)continue;
-        ptr = heap_start + *link;
-        while (FREE_NEXT(ptr) != 1)
+        if (*link == NIL)continue;
+        ptr = ADDRESS(*link);
+        while (FREE_NEXT(ptr) != NIL)
         {
-            if (ptr != heap_start + FREE_PREV(heap_start + FREE_NEXT(ptr)))
+            if (ptr != ADDRESS(FREE_PREV(ADDRESS(FREE_NEXT(ptr)))))
             {
                 fprintf(stderr, "%d: inconsistent pointers\n", lineno);
                 exit(1);
             }
-            ptr = heap_start + FREE_NEXT(ptr);
+            ptr = ADDRESS(FREE_NEXT(ptr));
         }
     }
 
@@ -536,9 +1501,9 @@ void mm_checkheap(int lineno)
     for (int i = 0; i < LIST_LEN; i++)
     {
         link = link_start + i;
-        if (*link == 1)continue;
-        ptr = heap_start + *link;
-        while (FREE_NEXT(ptr) != 1)
+        if (*link == NIL)continue;
+        ptr = ADDRESS(*link);
+        while (FREE_NEXT(ptr) != NIL)
         {
             if (ptr < mem_heap_lo())
             {
@@ -550,7 +1515,7 @@ void mm_checkheap(int lineno)
                 fprintf(stderr, "%d: pointer after mem_heap_hi\n", lineno);
                 exit(1);
             }
-            ptr = heap_start + FREE_NEXT(ptr);
+            ptr = ADDRESS(FREE_NEXT(ptr));
         }
     }
 
@@ -567,13 +1532,13 @@ void mm_checkheap(int lineno)
     for (int i = 0; i < LIST_LEN; i++)
     {
         link = link_start + i;
-        if (*link == 1)continue;
-        ptr = heap_start + *link;
+        if (*link == NIL)continue;
+        ptr = ADDRESS(*link);
         traverse++;
-        while (FREE_NEXT(ptr) != 1)
+        while (FREE_NEXT(ptr) != NIL)
         {
             traverse++;
-            ptr = heap_start + FREE_NEXT(ptr);
+            ptr = ADDRESS(FREE_NEXT(ptr));
         }
     }
     if (iterate != traverse)
@@ -582,22 +1547,32 @@ void mm_checkheap(int lineno)
         exit(1);
     }
 
-    // 4. All blocks in each list bucket fall within bucket size range.
+    // 4. The bitmap marks exactly the non-empty lists.
+    for (int i = 0; i < LIST_LEN; i++)
+    {
+        if (!(bin_map >> i & 1) != (link_start[i] == NIL))
+        {
+            fprintf(stderr, "%d: bitmap and list %d not match\n", lineno, i);
+            exit(1);
+        }
+    }
+
+    // 5. All blocks in each list bucket fall within bucket size range.
     int list_no;
     for (int i = 0; i < LIST_LEN; i++)
     {
         link = link_start + i;
-        if (*link == 1)continue;
-        ptr = heap_start + *link;
+        if (*link == NIL)continue;
+        ptr = ADDRESS(*link);
         list_no = GET_NO(FREE_SIZE(ptr));
         if (list_no != i)
         {
             fprintf(stderr, "%d: free block in wrong list\n", lineno);
             exit(1);
         }
-        while (FREE_NEXT(ptr) != 1)
+        while (FREE_NEXT(ptr) != NIL)
         {
-            ptr = heap_start + FREE_NEXT(ptr);
+            ptr = ADDRESS(FREE_NEXT(ptr));
             list_no = GET_NO(FREE_SIZE(ptr));
             if (list_no != i)
             {
@@ -606,4 +1581,373 @@ void mm_checkheap(int lineno)
             }
         }
     }
+
+#if defined(FIFO) || defined(ADDR_ORDER)
+    // 6. Each list keeps the order of the insert policy: ascending
+    //    addresses, or its last block in link_tail.
+    for (int i = 0; i < LIST_LEN; i++)
+    {
+        void *last = NULL;
+        for (unsigned int off = link_start[i]; off != NIL; off = FREE_NEXT(ptr))
+        {
+            ptr = ADDRESS(off);
+#ifdef ADDR_ORDER
+            if (last && ptr <= last)
+            {
+                fprintf(stderr, "%d: list %d not in address order\n",
+                        lineno, i);
+                exit(1);
+            }
+#endif
+            last = ptr;
+        }
+#ifdef FIFO
+        if (link_tail[i] == NIL ? last != NULL : last != ADDRESS(link_tail[i]))
+        {
+            fprintf(stderr, "%d: tail of list %d not match\n", lineno, i);
+            exit(1);
+        }
+#endif
+    }
+#endif
+
+#ifdef SLAB
+    /* Checking the runs */
+
+    // 1. Every run with free slots is in the list of its own class, and its
+    //    free slot count matches its bitmap.
+    for (int cls = 1; cls <= SLAB_LEN; cls++)
+    {
+        for (unsigned int no = SLAB_HEAD(cls); no != NIL; no = RUN_NEXT(ptr))
+        {
+            ptr = PAGE_AT(no);
+            if ((size_t)ptr % PAGESIZE || page_map[PAGE_NO(ptr)] != cls ||
+                RUN_CLASS(ptr) != cls)
+            {
+                fprintf(stderr, "%d: run in wrong list\n", lineno);
+                exit(1);
+            }
+            int used = 0;
+            for (int i = 0; i < (RUN_HDR - 16) / 8; i++)
+                used += __builtin_popcountl(RUN_MAP(ptr)[i]);
+            if (!RUN_NFREE(ptr) ||
+                RUN_NFREE(ptr) != (RUN_HDR - 16) * 8 - used)
+            {
+                fprintf(stderr, "%d: run free count not match\n", lineno);
+                exit(1);
+            }
+        }
+    }
+#endif
+
+#ifdef FASTBIN
+    /* Checking the fast bins */
+
+    // 1. Every block in a fast bin is allocated, of the size of its bin, and
+    //    the bins hold fb_count blocks.
+    int fb_blocks = 0;
+    for (int i = 1; i <= FB_MAX_SIZE / 8; i++)
+    {
+        for (unsigned int off = fb_head[i]; off != NIL; off = FB_NEXT(ptr))
+        {
+            ptr = ADDRESS(off);
+            if (!ALLOC_TAG(ptr) || ALLOC_SIZE(ptr) != (size_t)i << 3)
+            {
+                fprintf(stderr, "%d: block in wrong fast bin\n", lineno);
+                exit(1);
+            }
+            fb_blocks++;
+        }
+    }
+    if (fb_blocks != fb_count)
+    {
+        fprintf(stderr, "%d: fast bin count not match\n", lineno);
+        exit(1);
+    }
+#endif
+}
+
+
+#ifndef DRIVER
+/*
+ * The allocator of libc, for libmm.so. These take mm_lock around the mm_
+ * functions, set up the heap at the first call, and return NULL with errno
+ * set to ENOMEM where those return -1.
+ */
+#undef malloc
+#undef free
+#undef free_sized
+#undef realloc
+#undef calloc
+#undef malloc_batch
+#undef free_batch
+#undef memalign
+#undef malloc_usable_size
+#undef mm_trim
+
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void mm_lock_acquire(void)
+{
+    pthread_mutex_lock(&mm_lock);
+}
+
+
+static void mm_lock_release(void)
+{
+    pthread_mutex_unlock(&mm_lock);
+}
+
+
+/*
+ * mm_atfork - Hold mm_lock across fork, so that the child does not get the
+ *     heap in the middle of a call of another thread.
+ */
+__attribute__((constructor))
+static void mm_atfork(void)
+{
+    pthread_atfork(mm_lock_acquire, mm_lock_release, mm_lock_release);
+}
+
+
+/*
+ * enter - Take mm_lock, and set up the heap if it is not yet. Return 0 on
+ *     success, -1 with mm_lock released if the heap cannot be set up.
+ */
+static int enter(void)
+{
+    mm_lock_acquire();
+    if (heap_start == 0 && mm_init() < 0)
+    {
+        mm_lock_release();
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * leave - Release mm_lock and return ptr, or NULL for -1.
+ */
+static void *leave(void *ptr)
+{
+    mm_lock_release();
+    if (ptr != (void *)-1)return ptr;
+    errno = ENOMEM;
+    return NULL;
+}
+
+
+void *malloc(size_t size)
+{
+    if (enter() < 0)return NULL;
+    return leave(mm_malloc(size ? size : 1));
+}
+
+
+void free(void *ptr)
+{
+    if (!ptr || enter() < 0)return;
+    mm_free(ptr);
+    mm_lock_release();
+}
+
+
+void free_sized(void *ptr, size_t size)
+{
+    if (!ptr || enter() < 0)return;
+    mm_free_sized(ptr, size ? size : 1);
+    mm_lock_release();
+}
+
+
+void free_aligned_sized(void *ptr, size_t align, size_t size)
+{
+    free_sized(ptr, size);
+}
+
+
+void *realloc(void *ptr, size_t size)
+{
+    if (enter() < 0)return NULL;
+    return leave(mm_realloc(ptr, ptr || size ? size : 1));
+}
+
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (size && nmemb > (size_t)-1 / size) { errno = ENOMEM; return NULL; }
+    if (nmemb == 0 || size == 0)nmemb = size = 1;
+    if (enter() < 0)return NULL;
+    return leave(mm_calloc(nmemb, size));
+}
+
+
+int malloc_batch(size_t size, size_t n, void **out)
+{
+    if (enter() < 0)return -1;
+    int ret = mm_malloc_batch(size ? size : 1, n, out);
+    mm_lock_release();
+    if (ret < 0)errno = ENOMEM;
+    return ret;
+}
+
+
+void free_batch(void **ptrs, size_t n)
+{
+    if (enter() < 0)return;
+    mm_free_batch(ptrs, n);
+    mm_lock_release();
+}
+
+
+void *memalign(size_t align, size_t size)
+{
+    if (align & (align - 1)) { errno = EINVAL; return NULL; }
+    if (enter() < 0)return NULL;
+    return leave(mm_memalign(align, size ? size : 1));
+}
+
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    if (align % sizeof(void *) || (align & (align - 1)))return EINVAL;
+    void *ptr = memalign(align, size);
+    if (ptr == NULL)return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+
+void *valloc(size_t size)
+{
+    return memalign(PAGESIZE, size);
+}
+
+
+void *pvalloc(size_t size)
+{
+    return memalign(PAGESIZE, (size + PAGESIZE - 1) & ~(PAGESIZE - 1));
+}
+
+
+size_t malloc_usable_size(void *ptr)
+{
+    if (!ptr || enter() < 0)return 0;
+    size_t size = mm_usable_size(ptr);
+    mm_lock_release();
+    return size;
+}
+
+
+int mm_trim(size_t pad)
+{
+    if (enter() < 0)return 0;
+    int ret = mm_trim_unlocked(pad);
+    mm_lock_release();
+    return ret;
+}
+#endif
+
+
+/*
+ * Arenas hand out blocks by bumping a pointer through chunks taken from
+ * the heap with malloc, and give them all back at once. The first chunk
+ * starts with the mm_arena_t itself; later chunks start with a link to
+ * the one before. These come last so that, without -DDRIVER, the chunks
+ * come from the malloc and free above, under mm_lock; with -DDRIVER they
+ * are mm_malloc and mm_free. An arena is used by one thread at a time.
+ */
+#define ARENA_CHUNK (64 * 1024)
+#define ARENA_START(arena) ((char *)(arena) + ALIGN(sizeof(mm_arena_t)))
+
+struct mm_arena {
+    char *cur;          /* next free byte of the current chunk */
+    char *end;          /* end of the current chunk */
+    void **chunks;      /* the chunks after the first, newest first */
+    size_t chunk_size;
+};
+
+
+/*
+ * mm_arena_create - Return a new arena that takes chunks of chunk bytes
+ *     (ARENA_CHUNK if 0) from the heap, or NULL on error.
+ */
+mm_arena_t *mm_arena_create(size_t chunk)
+{
+    chunk = chunk ? ALIGN(MAX(chunk, 4 * sizeof(mm_arena_t))) : ARENA_CHUNK;
+    if (chunk >= HEAP_REACH)return NULL;
+    mm_arena_t *arena = malloc(chunk);
+    if (arena == NULL || arena == (void *)-1)return NULL;
+    arena->cur = ARENA_START(arena);
+    arena->end = (char *)arena + chunk;
+    arena->chunks = NULL;
+    arena->chunk_size = chunk;
+    return arena;
+}
+
+
+/*
+ * mm_arena_alloc - Return a block of size bytes, aligned to 8, bumped off
+ *     the current chunk of arena, or NULL on error. A block that does not
+ *     fit starts a new chunk, or gets a chunk of its own if it is larger
+ *     than a quarter of one, so that the current chunk is kept.
+ */
+void *mm_arena_alloc(mm_arena_t *arena, size_t size)
+{
+    if (size >= HEAP_REACH)return NULL;
+    size = ALIGN(size ? size : 1);
+    if (size <= (size_t)(arena->end - arena->cur))
+    {
+        void *ptr = arena->cur;
+        arena->cur += size;
+        return ptr;
+    }
+    int own = size > arena->chunk_size / 4;
+    void **chunk = malloc(own ? size + sizeof(void *) : arena->chunk_size);
+    if (chunk == NULL || chunk == (void *)-1)return NULL;
+    chunk[0] = arena->chunks;
+    arena->chunks = chunk;
+    if (own)return chunk + 1;
+    arena->cur = (char *)(chunk + 1) + size;
+    arena->end = (char *)chunk + arena->chunk_size;
+    return chunk + 1;
+}
+
+
+/*
+ * mm_arena_reset - Free every block of arena at once. The first chunk is
+ *     kept for the blocks to come, and the others are freed.
+ */
+void mm_arena_reset(mm_arena_t *arena)
+{
+    void **chunk = arena->chunks;
+    while (chunk != NULL)
+    {
+        void **prev = chunk[0];
+        free(chunk);
+        chunk = prev;
+    }
+    arena->cur = ARENA_START(arena);
+    arena->end = (char *)arena + arena->chunk_size;
+    arena->chunks = NULL;
+}
+
+
+/*
+ * mm_arena_destroy - Free every block of arena and the arena itself.
+ */
+void mm_arena_destroy(mm_arena_t *arena)
+{
+    if (!arena)return;
+    mm_arena_reset(arena);
+    free(arena);
 }
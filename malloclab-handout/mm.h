@@ -5,20 +5,50 @@
 /* declare functions for driver tests */
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
+extern void mm_free_sized(void *ptr, size_t size);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc (size_t nmemb, size_t size);
+extern int mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern size_t mm_usable_size(void *ptr);
+
+/* 1 in the packages that may be called by several threads at once */
+extern const int mm_thread_safe;
 
 #else
 
 /* declare functions for interpositioning */
 extern void *malloc (size_t size);
 extern void free (void *ptr);
+extern void free_sized(void *ptr, size_t size);
 extern void *realloc(void *ptr, size_t size);
 extern void *calloc (size_t nmemb, size_t size);
+extern int malloc_batch(size_t size, size_t n, void **out);
+extern void free_batch(void **ptrs, size_t n);
+extern int posix_memalign(void **memptr, size_t alignment, size_t size);
+extern size_t malloc_usable_size(void *ptr);
 
 #endif
 
 extern int mm_init(void);
 
+/* give the free top of the heap back to memlib, keeping pad bytes */
+extern int mm_trim(size_t pad);
+
+/* give back free pages, following the decay unless all; start a purger */
+extern size_t mm_purge(int all);
+extern int mm_purge_start(void);
+
+/* mallocs served by / looking up the per-thread cache since mm_init */
+extern void mm_tcache_stats(long *hits, long *lookups);
+
+/* bump-pointer arenas of blocks that are all freed at once */
+typedef struct mm_arena mm_arena_t;
+extern mm_arena_t *mm_arena_create(size_t chunk);
+extern void *mm_arena_alloc(mm_arena_t *arena, size_t size);
+extern void mm_arena_reset(mm_arena_t *arena);
+extern void mm_arena_destroy(mm_arena_t *arena);
+
 /* This is largely for debugging. */
 extern void mm_checkheap(int lineno);
@@ -0,0 +1,281 @@
+/*
+ * mmrec.c - An allocation recorder, built as libmmrec.so, that wraps the
+ *     malloc, free, realloc, calloc and aligned allocation functions of
+ *     libc to record the calls of a program into a raw file (see mmrec.h):
+ *
+ *     unix> LD_PRELOAD=./libmmrec.so MMREC_FILE=app program args...
+ *     unix> ./rec2rep app.1234.raw app.rep
+ *
+ * Each process writes <MMREC_FILE>.<pid>.raw (MMREC_FILE defaults to
+ * "mmrec"), opened when it first writes records. To keep the overhead
+ * low, each thread buffers its records and writes them a buffer at a
+ * time; a shared counter orders the records of all threads. The buffer
+ * of a thread is written when it is full, when the thread exits, and for
+ * the main thread when the process exits; the records of threads still
+ * running at exit, or before an exec, are lost.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "mmrec.h"
+
+#define BUF_RECS 4096 /* records buffered by each thread */
+
+/* the allocator of glibc, which the wrappers call */
+extern void *__libc_malloc(size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+/* The records of one thread not written yet */
+typedef struct {
+    int n;
+    mmrec_t recs[BUF_RECS];
+} buf_t;
+
+static __thread buf_t *buf;  /* this thread's buffer, mapped on first use */
+static __thread int busy;    /* set while recording, so that allocations
+                                of the recorder itself are not recorded */
+static __thread uint32_t tid; /* this thread's id, for its records */
+
+static int fd = -1;          /* the raw file, or -1 until opened */
+static pthread_mutex_t fd_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t seq;         /* the seq of the next record */
+static pthread_key_t key;    /* to write the buffer of an exiting thread */
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+/*
+ * open_raw - Open a new raw file for this process, and write its magic
+ *     before other threads can see it. The name gets a number if a
+ *     process of the same pid, which this one exec'd, already wrote one.
+ */
+static void open_raw(void)
+{
+    const char *prefix = getenv("MMREC_FILE");
+    char name[PATH_MAX];
+    int i, f = -1;
+
+    if (prefix == NULL)
+        prefix = "mmrec";
+    for (i = 0; i < 100; i++) {
+        if (i == 0)
+            snprintf(name, sizeof(name), "%s.%d.raw", prefix, (int)getpid());
+        else
+            snprintf(name, sizeof(name), "%s.%d.%d.raw", prefix,
+                     (int)getpid(), i);
+        f = open(name, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC,
+                 0644);
+        if (f >= 0 || errno != EEXIST)
+            break;
+    }
+    if (f >= 0 && write(f, MMREC_MAGIC, MMREC_MAGIC_LEN) != MMREC_MAGIC_LEN) {
+        close(f);
+        f = -1;
+    }
+    fd = f;
+}
+
+/*
+ * flush - Write the records in b to the raw file. Appends of a single
+ *     write do not interleave, so the buffers of the threads stay whole.
+ */
+static void flush(buf_t *b)
+{
+    char *p = (char *)b->recs;
+    size_t left = b->n * sizeof(mmrec_t);
+    ssize_t n;
+
+    if (b->n == 0)
+        return;
+    if (fd < 0) {
+        pthread_mutex_lock(&fd_lock);
+        if (fd < 0)
+            open_raw();
+        pthread_mutex_unlock(&fd_lock);
+    }
+    while (fd >= 0 && left > 0) {
+        if ((n = write(fd, p, left)) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        p += n;
+        left -= n;
+    }
+    b->n = 0;
+}
+
+/*
+ * thread_exit - Write and unmap the buffer of an exiting thread.
+ */
+static void thread_exit(void *ptr)
+{
+    busy = 1;
+    flush(ptr);
+    munmap(ptr, sizeof(buf_t));
+    buf = NULL;
+}
+
+/*
+ * child - After a fork, record the child in a raw file of its own. The
+ *     records the parent had buffered are the parent's to write.
+ */
+static void child(void)
+{
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+    pthread_mutex_init(&fd_lock, NULL);
+    if (buf != NULL)
+        buf->n = 0;
+    tid = (uint32_t)syscall(SYS_gettid);
+}
+
+/*
+ * init - Get ready to record, at the first record of the process.
+ */
+static void init(void)
+{
+    pthread_key_create(&key, thread_exit);
+    pthread_atfork(NULL, NULL, child);
+}
+
+/*
+ * fini - Write the buffer of the main thread as the process exits.
+ */
+__attribute__((destructor))
+static void fini(void)
+{
+    busy = 1;
+    if (buf != NULL)
+        flush(buf);
+}
+
+/*
+ * next_seq - Take the seq of a record to be made later.
+ */
+static uint64_t next_seq(void)
+{
+    return __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * record_seq - Add a record of seq s to the buffer of this thread.
+ */
+static void record_seq(int type, void *ptr, void *old, size_t size,
+                       uint64_t s)
+{
+    mmrec_t *r;
+
+    if (busy)
+        return;
+    busy = 1;
+    pthread_once(&once, init);
+    if (buf == NULL) {
+        buf = mmap(NULL, sizeof(buf_t), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf == MAP_FAILED) {
+            buf = NULL;
+            busy = 0;
+            return;
+        }
+        pthread_setspecific(key, buf);
+        tid = (uint32_t)syscall(SYS_gettid);
+    }
+    r = &buf->recs[buf->n++];
+    r->seq = s;
+    r->ptr = (uintptr_t)ptr;
+    r->old = (uintptr_t)old;
+    r->size = size;
+    r->type = type;
+    r->tid = tid;
+    if (buf->n == BUF_RECS)
+        flush(buf);
+    busy = 0;
+}
+
+/*
+ * record - Add a record to the buffer of this thread.
+ */
+static void record(int type, void *ptr, void *old, size_t size)
+{
+    record_seq(type, ptr, old, size, next_seq());
+}
+
+/*
+ * The wrappers. A block is recorded once it is allocated and before it
+ * is freed, so that seq puts the free of a block after its allocation
+ * even if they are in different threads. realloc frees the old block,
+ * so it takes its seq before calling libc.
+ */
+void *malloc(size_t size)
+{
+    void *p = __libc_malloc(size);
+
+    if (p != NULL)
+        record(MMREC_ALLOC, p, NULL, size);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr != NULL)
+        record(MMREC_FREE, ptr, NULL, 0);
+    __libc_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    uint64_t s = next_seq();
+    void *p = __libc_realloc(ptr, size);
+
+    if (p != NULL || (ptr != NULL && size == 0))
+        record_seq(MMREC_REALLOC, p, ptr, size, s);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p = __libc_calloc(nmemb, size);
+
+    if (p != NULL)
+        record(MMREC_ALLOC, p, NULL, nmemb * size);
+    return p;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *p = __libc_memalign(alignment, size);
+
+    if (p != NULL)
+        record(MMREC_ALLOC, p, NULL, size);
+    return p;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment % sizeof(void *) != 0 ||
+        (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    if ((p = memalign(alignment, size)) == NULL)
+        return ENOMEM;
+    *memptr = p;
+    return 0;
+}
@@ -0,0 +1,31 @@
+/*
+ * mmrec.h - The raw records written by the allocation recorder
+ *     libmmrec.so (mmrec.c), which rec2rep turns into a .rep trace.
+ *
+ * A raw file is MMREC_MAGIC followed by mmrec_t records, in the native
+ * byte order. The records of each thread are written a buffer at a time,
+ * so they are not in order: seq orders the records of all threads.
+ */
+#ifndef MMREC_H
+#define MMREC_H
+
+#include <stdint.h>
+
+#define MMREC_MAGIC     "MMREC\r\n\n"
+#define MMREC_MAGIC_LEN 8
+
+/* record types */
+#define MMREC_ALLOC   0 /* ptr = malloc(size), calloc, memalign... */
+#define MMREC_FREE    1 /* free(ptr) */
+#define MMREC_REALLOC 2 /* ptr = realloc(old, size) */
+
+typedef struct {
+    uint64_t seq;   /* order of the call among all threads */
+    uint64_t ptr;   /* block returned, or freed */
+    uint64_t old;   /* block passed to realloc */
+    uint64_t size;  /* size requested */
+    uint32_t type;
+    uint32_t tid;   /* thread of the call, for debugging */
+} mmrec_t;
+
+#endif /* MMREC_H */
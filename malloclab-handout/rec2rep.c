@@ -0,0 +1,283 @@
+/*
+ * rec2rep.c - Turn a raw file written by the allocation recorder
+ *     libmmrec.so (see mmrec.h) into a .rep trace for mdriver.
+ *
+ * usage: rec2rep [-w weight] <in.raw> <out.rep>
+ *
+ * The records of all threads are put in the order of their seq, and the
+ * blocks get ids in the order they are allocated, reusing the ids of the
+ * blocks freed, so that the driver's table of blocks stays as small as
+ * the largest live set. Frees of blocks allocated before recording began
+ * (or by a function not wrapped) are dropped, a realloc of such a block
+ * becomes an allocation, and allocations of 0 bytes, which mm_malloc
+ * need not serve, ask for 1 byte. The blocks still live at the end of
+ * the recording are left live.
+ */
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mmrec.h"
+
+/* An op of the trace, kept until the header can be written */
+typedef struct {
+    char type;       /* 'a', 'f' or 'r' */
+    int id;
+    uint64_t size;
+} op_t;
+
+/*
+ * The blocks live at a point of the recording: an open-addressing hash
+ * table from the address of each block to its id.
+ */
+typedef struct {
+    uint64_t addr;   /* 0 for an empty slot */
+    int id;
+} slot_t;
+
+static slot_t *table;
+static size_t table_size, table_used;  /* table_size is a power of 2 */
+
+static op_t *ops;
+static size_t nops, ops_cap;
+
+static int *free_ids;                  /* ids of the blocks freed */
+static size_t nfree, free_cap;
+static int num_ids;
+
+/*
+ * grow - Resize the array *p of *cap elements of size elem to hold n.
+ */
+static void grow(void *p, size_t *cap, size_t n, size_t elem)
+{
+    if (n <= *cap)
+        return;
+    *cap = *cap ? *cap * 2 : 1024;
+    if (*cap < n)
+        *cap = n;
+    if ((*(void **)p = realloc(*(void **)p, *cap * elem)) == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+}
+
+/*
+ * hash - Return the home slot of addr.
+ */
+static size_t hash(uint64_t addr)
+{
+    return (size_t)((addr >> 4) * 0x9e3779b97f4a7c15ULL >> 20) &
+        (table_size - 1);
+}
+
+/*
+ * lookup - Return the slot of addr, or the empty slot where it belongs.
+ */
+static slot_t *lookup(uint64_t addr)
+{
+    size_t i = hash(addr);
+
+    while (table[i].addr != 0 && table[i].addr != addr)
+        i = (i + 1) & (table_size - 1);
+    return &table[i];
+}
+
+/*
+ * insert - Record that the block at addr has id.
+ */
+static void insert(uint64_t addr, int id)
+{
+    slot_t *old = table, *s;
+    size_t old_size = table_size, i;
+
+    if (2 * (table_used + 1) > table_size) {
+        table_size = table_size ? 2 * table_size : 1 << 16;
+        if ((table = calloc(table_size, sizeof(slot_t))) == NULL) {
+            perror("calloc");
+            exit(1);
+        }
+        for (i = 0; i < old_size; i++)
+            if (old[i].addr != 0)
+                *lookup(old[i].addr) = old[i];
+        free(old);
+    }
+    s = lookup(addr);
+    table_used += s->addr == 0;
+    s->addr = addr;
+    s->id = id;
+}
+
+/*
+ * remove_slot - Empty slot s, moving back the slots after it that would
+ *     no longer be found.
+ */
+static void remove_slot(slot_t *s)
+{
+    size_t i = s - table, j = i, k;
+
+    for (;;) {
+        j = (j + 1) & (table_size - 1);
+        if (table[j].addr == 0)
+            break;
+        k = hash(table[j].addr);
+        /* leave slot j if its home k lies cyclically in (i, j] */
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        table[i] = table[j];
+        i = j;
+    }
+    table[i].addr = 0;
+    table_used--;
+}
+
+/*
+ * emit - Add an op to the trace.
+ */
+static void emit(char type, int id, uint64_t size)
+{
+    grow(&ops, &ops_cap, nops + 1, sizeof(op_t));
+    ops[nops].type = type;
+    ops[nops].id = id;
+    ops[nops].size = size ? size : 1;
+    nops++;
+}
+
+/*
+ * free_block - Emit the free of the block in slot s.
+ */
+static void free_block(slot_t *s)
+{
+    emit('f', s->id, 0);
+    grow(&free_ids, &free_cap, nfree + 1, sizeof(int));
+    free_ids[nfree++] = s->id;
+    remove_slot(s);
+}
+
+/*
+ * alloc_block - Emit the allocation of a block of size at addr. A block
+ *     still live at addr was freed without a record (as by a realloc
+ *     racing with another thread), so it is freed first.
+ */
+static void alloc_block(uint64_t addr, uint64_t size)
+{
+    slot_t *s;
+    int id;
+
+    if (table_size > 0 && (s = lookup(addr))->addr != 0)
+        free_block(s);
+    id = nfree > 0 ? free_ids[--nfree] : num_ids++;
+    emit('a', id, size);
+    insert(addr, id);
+}
+
+/*
+ * by_seq - Order records for qsort.
+ */
+static int by_seq(const void *a, const void *b)
+{
+    uint64_t x = ((const mmrec_t *)a)->seq, y = ((const mmrec_t *)b)->seq;
+
+    return x < y ? -1 : x > y;
+}
+
+
+int main(int argc, char **argv)
+{
+    FILE *out;
+    struct stat st;
+    char *map;
+    mmrec_t *recs, *r;
+    slot_t *s;
+    size_t nrecs, i;
+    int fd, id, c, weight = 1;
+
+    while ((c = getopt(argc, argv, "w:")) != -1) {
+        if (c != 'w')
+            break;
+        weight = atoi(optarg);
+    }
+    if (c != -1 || argc - optind != 2) {
+        fprintf(stderr, "usage: %s [-w weight] <in.raw> <out.rep>\n",
+                argv[0]);
+        exit(1);
+    }
+
+    /* map the records privately, to sort them in place */
+    if ((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    if (st.st_size < MMREC_MAGIC_LEN ||
+        (map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fd, 0)) == MAP_FAILED ||
+        memcmp(map, MMREC_MAGIC, MMREC_MAGIC_LEN) != 0) {
+        fprintf(stderr, "%s: not a raw file of libmmrec.so\n", argv[optind]);
+        exit(1);
+    }
+    close(fd);
+    recs = (mmrec_t *)(map + MMREC_MAGIC_LEN);
+    nrecs = (st.st_size - MMREC_MAGIC_LEN) / sizeof(mmrec_t);
+    qsort(recs, nrecs, sizeof(mmrec_t), by_seq);
+
+    for (i = 0; i < nrecs; i++) {
+        r = &recs[i];
+        s = NULL;
+        if (table_size > 0 && r->type != MMREC_ALLOC) {
+            s = lookup(r->type == MMREC_FREE ? r->ptr : r->old);
+            if (s->addr == 0)
+                s = NULL;
+        }
+        switch (r->type) {
+        case MMREC_ALLOC:
+            alloc_block(r->ptr, r->size);
+            break;
+        case MMREC_FREE:
+            if (s != NULL)
+                free_block(s);
+            break;
+        case MMREC_REALLOC:
+            if (s == NULL) {
+                if (r->ptr != 0)
+                    alloc_block(r->ptr, r->size);
+            } else if (r->ptr == 0) {
+                free_block(s);
+            } else {
+                /* the block keeps its id wherever it moves */
+                id = s->id;
+                remove_slot(s);
+                if ((s = lookup(r->ptr))->addr != 0)
+                    free_block(s);
+                emit('r', id, r->size);
+                insert(r->ptr, id);
+            }
+            break;
+        default:
+            fprintf(stderr, "%s: bad record type %u\n", argv[optind],
+                    r->type);
+            exit(1);
+        }
+    }
+    munmap(map, st.st_size);
+
+    if ((out = fopen(argv[optind + 1], "w")) == NULL) {
+        perror(argv[optind + 1]);
+        exit(1);
+    }
+    fprintf(out, "%d\n%d\n%zu\n%d\n", weight, num_ids, nops, 0);
+    for (i = 0; i < nops; i++) {
+        if (ops[i].type == 'f')
+            fprintf(out, "f %d\n", ops[i].id);
+        else
+            fprintf(out, "%c %d %" PRIu64 "\n", ops[i].type, ops[i].id,
+                    ops[i].size);
+    }
+    if (fclose(out) != 0) {
+        perror(argv[optind + 1]);
+        exit(1);
+    }
+    return 0;
+}
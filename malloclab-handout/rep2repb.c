@@ -0,0 +1,183 @@
+/*
+ * rep2repb.c - Convert a text .rep trace into the binary .repb format
+ *     read by mdriver, or with -z into the compressed .repz format that
+ *     mdriver streams (see repb.h).
+ *
+ * usage: rep2repb [-z] <in.rep> <out>
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "repb.h"
+
+/*
+ * put_varint - Write v to out, 7 bits per byte, low bits first.
+ */
+static void put_varint(FILE *out, uint64_t v)
+{
+    while (v >= 0x80) {
+        putc((int)(v & 0x7f) | 0x80, out);
+        v >>= 7;
+    }
+    putc((int)v, out);
+}
+
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    repb_header_t header;
+    repz_header_t zheader;
+    repb_op_t op;
+    char type[16];
+    uint64_t size = 0, last_size = 0, align;
+    int64_t i, num_ids, num_ops, num_arenas = 0;
+    int32_t last_index = 0;
+    int weight, ignore_ranges;
+    unsigned arena;
+    int c, compress = 0;
+
+    while ((c = getopt(argc, argv, "z")) != -1) {
+        if (c != 'z')
+            break;
+        compress = 1;
+    }
+    if (c != -1 || argc - optind != 2) {
+        fprintf(stderr, "usage: %s [-z] <in.rep> <out>\n", argv[0]);
+        exit(1);
+    }
+    if ((in = fopen(argv[optind], "r")) == NULL) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    if ((out = fopen(argv[optind + 1], "wb")) == NULL) {
+        perror(argv[optind + 1]);
+        exit(1);
+    }
+
+    if (fscanf(in, "%d %" SCNd64 " %" SCNd64 " %d", &weight, &num_ids,
+               &num_ops, &ignore_ranges) != 4 || num_ids < 0 || num_ops < 0) {
+        fprintf(stderr, "%s: bad trace header\n", argv[optind]);
+        exit(1);
+    }
+    if (num_ids > INT32_MAX || (!compress && num_ops > INT32_MAX)) {
+        fprintf(stderr, "%s: too many ids or ops for this format\n",
+                argv[optind]);
+        exit(1);
+    }
+    if (compress) {
+        memset(&zheader, 0, sizeof(zheader));
+        memcpy(zheader.magic, REPZ_MAGIC, REPB_MAGIC_LEN);
+        zheader.weight = weight;
+        zheader.ignore_ranges = ignore_ranges;
+        zheader.num_ids = num_ids;
+        zheader.num_ops = num_ops;
+        fwrite(&zheader, sizeof(zheader), 1, out);
+    } else {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, REPB_MAGIC, REPB_MAGIC_LEN);
+        header.weight = weight;
+        header.num_ids = num_ids;
+        header.num_ops = num_ops;
+        header.ignore_ranges = ignore_ranges;
+        fwrite(&header, sizeof(header), 1, out);
+    }
+
+    for (i = 0; i < num_ops; i++) {
+        memset(&op, 0, sizeof(op));
+        if (fscanf(in, "%15s %d", type, &op.index) != 2) {
+            fprintf(stderr, "%s: trace ends after %" PRId64 " of %" PRId64
+                    " ops\n", argv[optind], i, num_ops);
+            exit(1);
+        }
+        switch (type[0]) {
+        case 'a':
+        case 'r':
+            op.type = type[0] == 'a' ? REPB_ALLOC : REPB_REALLOC;
+            /* like mdriver, repeat the last size if this op has none */
+            if (fscanf(in, "%" SCNu64, &size) != 1 && i == 0) {
+                fprintf(stderr, "%s: op 0 has no size\n", argv[optind]);
+                exit(1);
+            }
+            op.size = size;
+            break;
+        case 'f':
+            op.type = REPB_FREE;
+            break;
+        case 'm':
+            op.type = REPB_MEMALIGN;
+            if (fscanf(in, "%" SCNu64 " %" SCNu64, &align, &size) != 2 ||
+                align == 0 || (align & (align - 1)) != 0) {
+                fprintf(stderr, "%s: bad memalign at op %" PRId64 "\n",
+                        argv[optind], i);
+                exit(1);
+            }
+            op.align = __builtin_ctzll(align);
+            op.size = size;
+            break;
+        case 'n': /* n <id> <arena> <size> */
+        case 'c': /* c <arena> <chunk> */
+        case 'x': /* x <arena> */
+        case 'd': /* d <arena> */
+            op.type = type[0] == 'n' ? REPB_ARENA_ALLOC :
+                type[0] == 'c' ? REPB_ARENA_CREATE :
+                type[0] == 'x' ? REPB_ARENA_RESET : REPB_ARENA_DESTROY;
+            arena = op.index;
+            if (type[0] != 'n')
+                op.index = -1;
+            else if (fscanf(in, "%u", &arena) != 1)
+                arena = UINT16_MAX + 1;
+            if ((type[0] == 'n' || type[0] == 'c') &&
+                fscanf(in, "%" SCNu64, &op.size) != 1)
+                arena = UINT16_MAX + 1;
+            if (arena > UINT16_MAX) {
+                fprintf(stderr, "%s: bad arena op at op %" PRId64 "\n",
+                        argv[optind], i);
+                exit(1);
+            }
+            op.arena = arena;
+            if (arena >= num_arenas)
+                num_arenas = arena + 1;
+            break;
+        default:
+            fprintf(stderr, "%s: bogus type character (%c) at op %" PRId64
+                    "\n", argv[optind], type[0], i);
+            exit(1);
+        }
+
+        if (!compress) {
+            fwrite(&op, sizeof(op), 1, out);
+            continue;
+        }
+        put_varint(out, ZIGZAG((int64_t)op.index - last_index) << 3 |
+                   (uint64_t)op.type);
+        last_index = op.index;
+        if (op.type != REPB_FREE && op.type < REPB_ARENA_RESET) {
+            put_varint(out, ZIGZAG(op.size - last_size));
+            last_size = op.size;
+        }
+        if (op.type == REPB_MEMALIGN)
+            put_varint(out, op.align);
+        if (op.type >= REPB_ARENA_ALLOC)
+            put_varint(out, op.arena);
+    }
+
+    /* the number of arenas is known only now: write the header again */
+    rewind(out);
+    if (compress) {
+        zheader.num_arenas = num_arenas;
+        fwrite(&zheader, sizeof(zheader), 1, out);
+    } else {
+        header.num_arenas = num_arenas;
+        fwrite(&header, sizeof(header), 1, out);
+    }
+
+    fclose(in);
+    if (fclose(out) != 0) {
+        perror(argv[optind + 1]);
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * repb.h - Binary trace format read by mdriver and written by rep2repb.
+ *
+ * A .repb file is a repb_header_t followed by num_ops packed repb_op_t
+ * records in host byte order. The records have the layout of mdriver's
+ * traceop_t, so the driver maps them into memory as they are.
+ *
+ * A .repz file holds the same ops compressed, for traces too long to keep
+ * in memory; the driver streams them. A repz_header_t is followed, for
+ * each op, by the varint ZIGZAG(index - last index) << 3 | type, for all
+ * but REPB_FREE, REPB_ARENA_RESET and REPB_ARENA_DESTROY the varint
+ * ZIGZAG(size - last size), where both last values start at 0, for
+ * REPB_MEMALIGN the varint log2 of the alignment, and for the arena ops
+ * the varint arena id. A varint is stored 7 bits per byte, low bits
+ * first, with the high bit set on every byte but the last.
+ */
+#include <stdint.h>
+
+#define REPB_MAGIC "REPB\r\n\032\n"
+#define REPB_MAGIC_LEN 8
+#define REPZ_MAGIC "REPZ\r\n\032\n"
+
+/* map signed deltas to unsigned varints with small magnitudes kept small */
+#define ZIGZAG(x) (((uint64_t)(x) << 1) ^ (uint64_t)((int64_t)(x) >> 63))
+#define UNZIGZAG(u) ((int64_t)((u) >> 1) ^ -(int64_t)((u) & 1))
+
+/* request types, in the order of mdriver's traceop_t enum */
+#define REPB_ALLOC 0
+#define REPB_FREE 1
+#define REPB_REALLOC 2
+#define REPB_MEMALIGN 3
+#define REPB_ARENA_ALLOC 4
+#define REPB_ARENA_CREATE 5
+#define REPB_ARENA_RESET 6
+#define REPB_ARENA_DESTROY 7
+
+typedef struct {
+    char magic[REPB_MAGIC_LEN]; /* REPB_MAGIC */
+    int32_t weight;             /* the four numbers heading a .rep file */
+    int32_t num_ids;
+    int32_t num_ops;
+    int32_t ignore_ranges;
+    int32_t num_arenas;         /* arena ids used by the arena ops */
+    int32_t reserved;           /* zero; keeps the records 8-byte aligned */
+} repb_header_t;
+
+typedef struct {
+    uint8_t type;               /* REPB_ALLOC, REPB_FREE, REPB_REALLOC... */
+    uint8_t align;              /* log2 of the alignment of REPB_MEMALIGN */
+    uint16_t arena;             /* arena id of the arena ops, else zero */
+    int32_t index;              /* block id, -1 for free(NULL) and the
+                                   arena ops but REPB_ARENA_ALLOC */
+    uint64_t size;              /* payload size, chunk size of
+                                   REPB_ARENA_CREATE, 0 for free */
+} repb_op_t;
+
+typedef struct {
+    char magic[REPB_MAGIC_LEN]; /* REPZ_MAGIC */
+    int32_t weight;
+    int32_t ignore_ranges;
+    int64_t num_ids;
+    int64_t num_ops;
+    int64_t num_arenas;
+} repz_header_t;